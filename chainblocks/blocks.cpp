@@ -433,6 +433,12 @@ struct Activate : public NetworkConsumer {
 };
 
 struct Predict final : public Activate {
+  void warmup(CBContext *context) {
+    Activate::warmup(context);
+    // inference only, run on a flat compiled plan
+    _netRef->freeze();
+  }
+
   CBVar activate(CBContext *context, const CBVar &input) {
     // NO-Copy activate
     NeuroVars in(input);
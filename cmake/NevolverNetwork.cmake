@@ -0,0 +1,21 @@
+# Builds a source written by Network::exportSource into a loadable module
+# usage: nevolver_add_network(<target> <source.c> [ARCH <march>])
+# the result is meant to be opened with Nevolver::CompiledNetwork
+function(nevolver_add_network target source)
+  cmake_parse_arguments(NETWORK "" "ARCH" "" ${ARGN})
+
+  add_library(${target} MODULE ${source})
+  set_target_properties(${target} PROPERTIES
+    PREFIX ""
+    C_VISIBILITY_PRESET hidden
+    CXX_VISIBILITY_PRESET hidden)
+
+  target_compile_options(${target} PRIVATE -O3 -fno-math-errno)
+  if(NETWORK_ARCH)
+    target_compile_options(${target} PRIVATE -march=${NETWORK_ARCH})
+  endif()
+
+  if(UNIX)
+    target_link_libraries(${target} PRIVATE m)
+  endif()
+endfunction()
@@ -0,0 +1,259 @@
+#ifndef CODEGEN_H
+#define CODEGEN_H
+
+#include "nevolver.hpp"
+#include "plan.hpp"
+
+#include <iomanip>
+#include <sstream>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <dlfcn.h>
+#endif
+
+namespace Nevolver {
+#ifndef NEVOLVER_WIDE
+/*
+Writes a plan as a self contained C source, constants baked in, one
+straight line statement per connection. The result exports:
+
+  size_t <name>_inputs(void);
+  size_t <name>_outputs(void);
+  size_t <name>_state_size(void);
+  void <name>_reset(float *state);
+  void <name>_activate(float *state, const float *input, float *output);
+
+state holds node states, activations and gains (same meaning as the plan
+ones) and is reset to the values the network had when exported.
+Squash functions mirror squash.hpp expression by expression.
+*/
+class SourceExporter final {
+public:
+  static void write(const ActivationPlan &plan, std::ostream &os,
+                    const std::string &name) {
+    const auto nsize = plan._nodes.size();
+    const auto gsize = plan._gains.size();
+    const auto stateSize = nsize * 2 + gsize;
+
+    os << "/* generated by nevolver, do not edit */\n";
+    os << "#include <math.h>\n#include <stddef.h>\n#include <string.h>\n\n";
+    os << "#ifdef _WIN32\n#define NEVOLVER_EXPORT __declspec(dllexport)\n"
+          "#else\n#define NEVOLVER_EXPORT "
+          "__attribute__((visibility(\"default\")))\n#endif\n\n";
+    os << "#ifdef __cplusplus\nextern \"C\" {\n#endif\n\n";
+
+    std::vector<float> init;
+    init.reserve(stateSize);
+    init.insert(init.end(), plan._state.begin(), plan._state.end());
+    init.insert(init.end(), plan._act.begin(), plan._act.end());
+    init.insert(init.end(), plan._gains.begin(), plan._gains.end());
+
+    os << "static const float " << name << "_init[" << stateSize << "] = {";
+    for (size_t i = 0; i < stateSize; i++) {
+      os << (i % 4 ? " " : "\n    ") << literal(init[i]) << ",";
+    }
+    os << "\n};\n\n";
+
+    writeSquash(os, name);
+
+    os << "NEVOLVER_EXPORT size_t " << name << "_inputs(void) { return "
+       << plan._inputs.size() << "; }\n";
+    os << "NEVOLVER_EXPORT size_t " << name << "_outputs(void) { return "
+       << plan._outputs.size() << "; }\n";
+    os << "NEVOLVER_EXPORT size_t " << name << "_state_size(void) { return "
+       << stateSize << "; }\n\n";
+    os << "NEVOLVER_EXPORT void " << name << "_reset(float *state) {\n"
+       << "  memcpy(state, " << name << "_init, sizeof(" << name
+       << "_init));\n}\n\n";
+
+    os << "NEVOLVER_EXPORT void " << name
+       << "_activate(float *state, const float *input, float *output) {\n";
+    os << "  float *st = state;\n  float *act = state + " << nsize
+       << ";\n  float *g = state + " << nsize * 2 << ";\n  float x;\n";
+    os << "  (void)g;\n";
+
+    for (size_t i = 0; i < plan._inputs.size(); i++) {
+      os << "  act[" << plan._inputs[i] << "] = input[" << i << "];\n";
+    }
+
+    for (size_t i = 0; i < nsize; i++) {
+      if (plan._ops[i] == ActivationPlan::InputOp)
+        continue;
+
+      writeNode(plan, os, i, name);
+    }
+
+    for (size_t o = 0; o < plan._outputs.size(); o++) {
+      os << "  output[" << o << "] = act[" << plan._outputs[o] << "];\n";
+    }
+    os << "}\n\n#ifdef __cplusplus\n}\n#endif\n";
+  }
+
+private:
+  static std::string literal(float value) {
+    if (std::isnan(value))
+      return "NAN";
+    if (std::isinf(value))
+      return value > 0 ? "INFINITY" : "-INFINITY";
+
+    // hex floats are exact
+    std::ostringstream ss;
+    ss << std::hexfloat << value << "f";
+    return ss.str();
+  }
+
+  static void writeSquash(std::ostream &os, const std::string &name) {
+    // same order as SquashFunc
+    const char *bodies[] = {
+        "return x;",
+        "return (float)(1.0 / (1.0 + expf(-x)));",
+        "return tanhf(x);",
+        "return x > 0.0 ? x : 0.0f;",
+        "return x > 0.0 ? x : (float)(x / 20.0);",
+        "return x > 0.0 ? x : 0.0f;",
+        "return (float)(x / (1.0 + fabsf(x)));",
+        "return sinf(x);",
+        "return (float)exp(-pow(x, 2.0));",
+        "return (float)((sqrt(pow(x, 2.0) + 1.0) - 1.0) / 2.0 + x);",
+        "return x > 0.0 ? 1.0f : -1.0f;",
+        "return (float)(2.0 / (1.0 + expf(-x)) - 1.0);",
+        "return x < -1.0 ? -1.0f : (x > 1.0 ? 1.0f : x);",
+        "return fabsf(x);",
+        "return (float)(1.0 - x);",
+        "float fx = x > 0.0 ? x : (float)(1.6732632423543772848170429916717 "
+        "* (expf(x) - 1.0));\n  return (float)(fx * "
+        "1.0507009873554804934193349852946);"};
+    static_assert(std::size(bodies) == std::variant_size_v<SquashFunc>,
+                  "Squash functions and exporter out of sync.");
+
+    for (size_t op = 0; op < std::size(bodies); op++) {
+      os << "static inline float " << name << "_squash" << op
+         << "(float x) {\n  " << bodies[op] << "\n}\n\n";
+    }
+  }
+
+  static void writeNode(const ActivationPlan &plan, std::ostream &os,
+                        size_t i, const std::string &name) {
+    os << "  /* node " << i << " */\n";
+    if (plan._flags[i] & ActivationPlan::SelfFlag) {
+      os << "  x = g[" << plan._selfGain[i] << "] * "
+         << literal(plan._selfW[i]) << " * st[" << i << "] + "
+         << literal(plan._bias[i]) << ";\n";
+    } else {
+      os << "  x = " << literal(plan._bias[i]) << ";\n";
+    }
+
+    plan.inbound(i, [&](uint32_t from, NeuroFloat w, uint32_t gain) {
+      os << "  x += act[" << from << "] * " << literal(w);
+      if (gain != 0)
+        os << " * g[" << gain << "]";
+      os << ";\n";
+    });
+
+    os << "  st[" << i << "] = x;\n";
+    os << "  act[" << i << "] = " << name << "_squash" << int(plan._ops[i])
+       << "(x) * " << literal(plan._mask[i]) << ";\n";
+
+    const auto gend = plan._gateStart[i + 1];
+    for (auto k = plan._gateStart[i]; k < gend; k++) {
+      os << "  g[" << plan._gateSlots[k] << "] = act[" << i << "];\n";
+    }
+  }
+};
+
+/*
+Loads a shared library built from an exported source and runs it.
+*/
+class CompiledNetwork final {
+public:
+  CompiledNetwork(const std::string &path, const std::string &name) {
+#ifdef _WIN32
+    _handle = LoadLibraryA(path.c_str());
+#else
+    _handle = dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
+#endif
+    if (!_handle)
+      throw std::runtime_error("Failed to load compiled network: " + path);
+
+    try {
+      _inputs = symbol<size_t (*)()>(name + "_inputs")();
+      _outputs = symbol<size_t (*)()>(name + "_outputs")();
+      _reset = symbol<void (*)(float *)>(name + "_reset");
+      _activate = symbol<void (*)(float *, const float *, float *)>(
+          name + "_activate");
+      _state.resize(symbol<size_t (*)()>(name + "_state_size")());
+    } catch (...) {
+      close();
+      throw;
+    }
+
+    reset();
+  }
+
+  ~CompiledNetwork() { close(); }
+
+  CompiledNetwork(const CompiledNetwork &) = delete;
+  CompiledNetwork &operator=(const CompiledNetwork &) = delete;
+
+  // back to the state the network had when exported
+  void reset() { _reset(_state.data()); }
+
+  template <typename SomeFloat, typename SomeFloatVector>
+  void activate(const SomeFloatVector &input, std::vector<SomeFloat> &output) {
+    if (input.size() != _inputs)
+      throw std::runtime_error(
+          "Invalid activation input size, differs from actual "
+          "network input size.");
+
+    _input.assign(input.begin(), input.end());
+    _output.resize(_outputs);
+    _activate(_state.data(), _input.data(), _output.data());
+    output.assign(_output.begin(), _output.end());
+  }
+
+  void activate(const float *input, float *output) {
+    _activate(_state.data(), input, output);
+  }
+
+  size_t inputs() const { return _inputs; }
+
+  size_t outputs() const { return _outputs; }
+
+private:
+  template <typename F> F symbol(const std::string &name) {
+#ifdef _WIN32
+    auto sym = (void *)GetProcAddress((HMODULE)_handle, name.c_str());
+#else
+    auto sym = dlsym(_handle, name.c_str());
+#endif
+    if (!sym)
+      throw std::runtime_error("Missing compiled network symbol: " + name);
+    return reinterpret_cast<F>(sym);
+  }
+
+  void close() {
+    if (!_handle)
+      return;
+#ifdef _WIN32
+    FreeLibrary((HMODULE)_handle);
+#else
+    dlclose(_handle);
+#endif
+    _handle = nullptr;
+  }
+
+  void *_handle = nullptr;
+  size_t _inputs = 0;
+  size_t _outputs = 0;
+  void (*_reset)(float *) = nullptr;
+  void (*_activate)(float *, const float *, float *) = nullptr;
+  std::vector<float> _state;
+  std::vector<float> _input;
+  std::vector<float> _output;
+};
+#endif
+} // namespace Nevolver
+
+#endif /* CODEGEN_H */
@@ -7,32 +7,82 @@ namespace Nevolver {
 enum ConnectionPattern { AllToAll, AllToElse, OneToOne };
 enum GatingPattern { Input, Output, Self };
 
-struct ConnectionXTraces {
-  std::vector<const Node *> nodes;
-  std::vector<NeuroFloat> values;
-};
+// no node, connection or weight
+constexpr uint32_t NoIndex = 0xFFFFFFFF;
 
 struct Connection final {
-  const Node *from;
-  const Node *to;
-  const Node *gater;
+  uint32_t from;
+  uint32_t to;
+  uint32_t gater;
+  uint32_t weight;
+  // position in the network active list
+  uint32_t active;
 
   NeuroFloat gain{1};
   NeuroFloat eligibility{0};
-  NeuroFloat previousDeltaWeight{0};
+};
 
-  mutable Weight *weight;
+struct NodeConnections final {
+  std::vector<uint32_t> inbound;
+  std::vector<uint32_t> outbound;
+  std::vector<uint32_t> gate;
+  uint32_t self = NoIndex;
+};
 
-  NeuroFloat w() const { return weight->first; }
+// Training state kept out of connections and nodes, arrays by weight, node
+// or connection index.
+struct Gradients final {
+  // sums over the samples propagated without updating
+  std::vector<NeuroFloat> weights;
+  std::vector<NeuroFloat> biases;
+  // first and second moments of the optimizer, see OptimizerStep
+  std::vector<NeuroFloat> weightSteps;
+  std::vector<NeuroFloat> biasSteps;
+  std::vector<NeuroFloat> weightSquares;
+  std::vector<NeuroFloat> biasSquares;
+  size_t samples = 0;
+  size_t updates = 0;
 
-  ConnectionXTraces xtraces;
+  // last deltas of updating propagation, by connection and by node
+  std::vector<NeuroFloat> connectionDeltas;
+  std::vector<NeuroFloat> biasDeltas;
 };
 
-struct NodeConnections final {
-  std::vector<Connection *> inbound;
-  std::vector<Connection *> outbound;
-  std::vector<Connection *> gate;
-  Connection *self = nullptr;
+// Extended eligibility traces of gated networks laid out flat, one slot per
+// inbound connection of a node and node that one gates. Built again after
+// topology changes, see Network::traces().
+struct XTraces final {
+  // by node, its first one in targets, the distinct nodes it gates
+  std::vector<uint32_t> firstTarget;
+  std::vector<uint32_t> targets;
+  // by target, the self connection of the node
+  std::vector<uint32_t> selfs;
+  // by gated connection, the target it feeds
+  std::vector<uint32_t> targetOf;
+  // by connection, its first slot, then the gated node and trace of each
+  std::vector<uint32_t> firstSlot;
+  std::vector<uint32_t> nodes;
+  std::vector<NeuroFloat> values;
+
+  // scratch by target, filled by the gater while activating
+  std::vector<NeuroFloat> influence;
+  std::vector<NeuroFloat> decay;
+};
+
+// A network storage as nodes see it, nodes, connections and weights refer to
+// each other by their index in these.
+struct Graph final {
+  std::vector<AnyNode> &nodes;
+  std::vector<Connection> &connections;
+  WeightVector &weights;
+  Gradients &gradients;
+  XTraces &traces;
+
+  inline const Node &node(uint32_t idx) const;
+
+  NeuroFloat w(const Connection &conn) const {
+    return std::as_const(weights)[conn.weight].first;
+  }
 };
 } // namespace Nevolver
 
@@ -0,0 +1,135 @@
+#ifndef COW_H
+#define COW_H
+
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+namespace Nevolver {
+/*
+A vector split in fixed size pages that copies share, a page is cloned the
+first time one of its holders writes into it. operator[] only reads and
+never unshares, writes go through mut(). Iterating a mutable vector takes
+private copies of every page.
+*/
+template <typename T, size_t PageSize = 64> class CowVector final {
+  struct Page {
+    T items[PageSize]{};
+  };
+
+  template <bool Const> class Iterator {
+  public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = T;
+    using difference_type = std::ptrdiff_t;
+    using pointer = std::conditional_t<Const, const T *, T *>;
+    using reference = std::conditional_t<Const, const T &, T &>;
+
+    Iterator(const CowVector *vec, size_t idx) : _vec(vec), _idx(idx) {}
+
+    // mutable ones come from begin() which already owns all pages
+    reference operator*() const { return const_cast<reference>((*_vec)[_idx]); }
+    pointer operator->() const { return &**this; }
+
+    Iterator &operator++() {
+      _idx++;
+      return *this;
+    }
+
+    bool operator==(const Iterator &other) const { return _idx == other._idx; }
+    bool operator!=(const Iterator &other) const { return _idx != other._idx; }
+
+  private:
+    const CowVector *_vec;
+    size_t _idx;
+  };
+
+public:
+  using value_type = T;
+  using iterator = Iterator<false>;
+  using const_iterator = Iterator<true>;
+
+  size_t size() const { return _size; }
+
+  bool empty() const { return _size == 0; }
+
+  const T &operator[](size_t idx) const {
+    return _items[idx / PageSize][idx % PageSize];
+  }
+
+  T &mut(size_t idx) { return own(idx / PageSize).items[idx % PageSize]; }
+
+  T &emplace_back() {
+    if (_size % PageSize == 0) {
+      _pages.emplace_back(std::make_shared<Page>());
+      _items.emplace_back(_pages.back()->items);
+    }
+
+    auto &item = own(_size / PageSize).items[_size % PageSize];
+    item = T();
+    _size++;
+    return item;
+  }
+
+  void push_back(const T &value) { emplace_back() = value; }
+
+  void reserve(size_t count) {
+    _pages.reserve((count + PageSize - 1) / PageSize);
+    _items.reserve((count + PageSize - 1) / PageSize);
+  }
+
+  void clear() {
+    _pages.clear();
+    _items.clear();
+    _size = 0;
+  }
+
+  void swap(CowVector &other) {
+    _pages.swap(other._pages);
+    _items.swap(other._items);
+    std::swap(_size, other._size);
+  }
+
+  // pages held by some other copy as well
+  size_t sharedPages() const {
+    size_t res = 0;
+    for (const auto &page : _pages) {
+      if (page.use_count() > 1)
+        res++;
+    }
+    return res;
+  }
+
+  size_t pages() const { return _pages.size(); }
+
+  iterator begin() {
+    for (size_t page = 0; page < _pages.size(); page++) {
+      own(page);
+    }
+    return iterator(this, 0);
+  }
+
+  iterator end() { return iterator(this, _size); }
+
+  const_iterator begin() const { return const_iterator(this, 0); }
+
+  const_iterator end() const { return const_iterator(this, _size); }
+
+private:
+  Page &own(size_t page) {
+    auto &ptr = _pages[page];
+    if (ptr.use_count() > 1) {
+      ptr = std::make_shared<Page>(*ptr);
+      _items[page] = ptr->items;
+    }
+    return *ptr;
+  }
+
+  std::vector<std::shared_ptr<Page>> _pages;
+  // page items without going through the shared pointers
+  std::vector<T *> _items;
+  size_t _size = 0;
+};
+} // namespace Nevolver
+
+#endif /* COW_H */
@@ -0,0 +1,121 @@
+#ifndef HALF_H
+#define HALF_H
+
+#include "nevolver.hpp"
+
+namespace Nevolver {
+// How weights and biases of a network are kept in frozen plans and saved
+// models. The live graph always holds float master copies so that training
+// steps smaller than the storage precision are not lost.
+enum class WeightStorage : uint8_t { Float, Half, BFloat16 };
+
+/*
+16 bit weight encodings, IEEE binary16 and bfloat16 (the upper half of a
+float), both rounding to nearest even. Conversions avoid branches so that
+widening loops vectorize, NeuroFloat values are packed lane by lane.
+*/
+struct PackedWeight {
+  constexpr static size_t Lanes = sizeof(NeuroFloat) / sizeof(float);
+
+  NEVOLVER_INLINE static uint16_t fromFloat(WeightStorage storage,
+                                            float value) {
+    return storage == WeightStorage::Half ? toHalf(value) : toBFloat16(value);
+  }
+
+  NEVOLVER_INLINE static float toFloat(WeightStorage storage,
+                                       uint16_t value) {
+    return storage == WeightStorage::Half ? fromHalf(value)
+                                          : fromBFloat16(value);
+  }
+
+  static void pack(WeightStorage storage, const NeuroFloat &value,
+                   uint16_t *packed) {
+    float lanes[Lanes];
+    std::memcpy(lanes, &value, sizeof(NeuroFloat));
+    for (size_t l = 0; l < Lanes; l++) {
+      packed[l] = fromFloat(storage, lanes[l]);
+    }
+  }
+
+  NEVOLVER_INLINE static NeuroFloat unpack(WeightStorage storage,
+                                           const uint16_t *packed) {
+    float lanes[Lanes];
+    for (size_t l = 0; l < Lanes; l++) {
+      lanes[l] = toFloat(storage, packed[l]);
+    }
+    NeuroFloat res;
+    std::memcpy(&res, lanes, sizeof(NeuroFloat));
+    return res;
+  }
+
+  // the closest value the storage can hold
+  static NeuroFloat round(WeightStorage storage, const NeuroFloat &value) {
+    if (storage == WeightStorage::Float)
+      return value;
+    uint16_t packed[Lanes];
+    pack(storage, value, packed);
+    return unpack(storage, packed);
+  }
+
+  NEVOLVER_INLINE static uint16_t toHalf(float value) {
+    constexpr uint32_t HalfMax = (127 + 16) << 23;
+    constexpr uint32_t DenormMagic = ((127 - 15) + (23 - 10) + 1) << 23;
+
+    auto f = bits(value);
+    const auto sign = f & 0x80000000u;
+    f ^= sign;
+
+    // too large becomes infinity, nan stays a (quiet) nan
+    const uint32_t inf = f > 0x7F800000u ? 0x7E00u : 0x7C00u;
+    // subnormal, let the float adder round the mantissa in place
+    const uint32_t denorm =
+        bits(fromBits(f) + fromBits(DenormMagic)) - DenormMagic;
+    // normal, rebias and round to nearest even
+    const uint32_t normal =
+        (f + (uint32_t(15 - 127) << 23) + 0xFFFu + ((f >> 13) & 1)) >> 13;
+
+    const auto res = f >= HalfMax ? inf : f < (113u << 23) ? denorm : normal;
+    return uint16_t(res | (sign >> 16));
+  }
+
+  NEVOLVER_INLINE static float fromHalf(uint16_t value) {
+    // exponent and mantissa at the top, sign shifted out
+    const uint32_t twice = uint32_t(value) << 17;
+    // rebias by scaling, infinities and nans stay as they are
+    const auto normal =
+        fromBits((twice >> 4) + (0xE0u << 23)) * fromBits(0x7800000u);
+    // subnormal, mantissa below a magic 0.5
+    const auto denorm = fromBits((twice >> 17) | (126u << 23)) - 0.5f;
+
+    const uint32_t isDenorm = 0u - uint32_t(twice < (1u << 27));
+    const auto res = (bits(denorm) & isDenorm) | (bits(normal) & ~isDenorm);
+    return fromBits(res | ((uint32_t(value) & 0x8000u) << 16));
+  }
+
+  NEVOLVER_INLINE static uint16_t toBFloat16(float value) {
+    const auto f = bits(value);
+    const auto nan = (f >> 16) | 0x40u;
+    const auto rounded = (f + 0x7FFFu + ((f >> 16) & 1)) >> 16;
+    return uint16_t((f & 0x7FFFFFFFu) > 0x7F800000u ? nan : rounded);
+  }
+
+  NEVOLVER_INLINE static float fromBFloat16(uint16_t value) {
+    return fromBits(uint32_t(value) << 16);
+  }
+
+private:
+  NEVOLVER_INLINE static uint32_t bits(float value) {
+    uint32_t res;
+    std::memcpy(&res, &value, sizeof(float));
+    return res;
+  }
+
+  NEVOLVER_INLINE static float fromBits(uint32_t value) {
+    float res;
+    std::memcpy(&res, &value, sizeof(float));
+    return res;
+  }
+};
+} // namespace Nevolver
+
+#endif /* HALF_H */
@@ -2,6 +2,10 @@
 #define NETWORK_H
 
 #include "nevolver.hpp"
+#include "codegen.hpp"
+#include "optimizer.hpp"
+#include "plan.hpp"
+#include "quantize.hpp"
 
 namespace Nevolver {
 enum class NetworkMutations {
@@ -31,35 +35,180 @@ public:
   }
 };
 
+// Connection index by edge key, open addressing with linear probing over a
+// flat array so that copying a network copies it in one go.
+class EdgeIndex final {
+public:
+  // NoIndex when missing
+  uint32_t find(uint64_t key) const {
+    if (_slots.empty())
+      return NoIndex;
+
+    for (auto i = bucket(key);; i = (i + 1) & mask()) {
+      const auto &slot = _slots[i];
+      if (slot.value == NoIndex || slot.key == key)
+        return slot.value;
+    }
+  }
+
+  // inserts or replaces
+  void assign(uint64_t key, uint32_t value) {
+    assert(value != NoIndex);
+    if ((_size + 1) * 4 > _slots.size() * 3)
+      rehash(std::max<size_t>(_slots.size() * 2, 16));
+
+    for (auto i = bucket(key);; i = (i + 1) & mask()) {
+      auto &slot = _slots[i];
+      if (slot.value == NoIndex) {
+        slot = {key, value};
+        _size++;
+        return;
+      }
+      if (slot.key == key) {
+        slot.value = value;
+        return;
+      }
+    }
+  }
+
+  void erase(uint64_t key) {
+    if (_slots.empty())
+      return;
+
+    auto hole = bucket(key);
+    for (;; hole = (hole + 1) & mask()) {
+      if (_slots[hole].value == NoIndex)
+        return;
+      if (_slots[hole].key == key)
+        break;
+    }
+
+    // shift back the entries that probed past the hole
+    for (auto i = (hole + 1) & mask(); _slots[i].value != NoIndex;
+         i = (i + 1) & mask()) {
+      const auto home = bucket(_slots[i].key);
+      if (((i - home) & mask()) >= ((i - hole) & mask())) {
+        _slots[hole] = _slots[i];
+        hole = i;
+      }
+    }
+    _slots[hole].value = NoIndex;
+    _size--;
+  }
+
+  void clear() {
+    _slots.clear();
+    _size = 0;
+  }
+
+  void reserve(size_t count) {
+    size_t capacity = 16;
+    while (capacity * 3 < count * 4)
+      capacity *= 2;
+    if (capacity > _slots.size())
+      rehash(capacity);
+  }
+
+  size_t size() const { return _size; }
+
+  void swap(EdgeIndex &other) {
+    _slots.swap(other._slots);
+    std::swap(_size, other._size);
+  }
+
+private:
+  struct Slot {
+    uint64_t key;
+    uint32_t value;
+  };
+
+  size_t mask() const { return _slots.size() - 1; }
+
+  size_t bucket(uint64_t key) const {
+    // fibonacci hashing, the top bits are the well mixed ones
+    return size_t((key * 0x9E3779B97F4A7C15ull) >> 32) & mask();
+  }
+
+  void rehash(size_t capacity) {
+    std::vector<Slot> old(capacity, Slot{0, NoIndex});
+    old.swap(_slots);
+    _size = 0;
+    for (const auto &slot : old) {
+      if (slot.value != NoIndex)
+        assign(slot.key, slot.value);
+    }
+  }
+
+  std::vector<Slot> _slots;
+  size_t _size = 0;
+};
+
 class Network {
 public:
   Network() = default;
 
-  Network(const Network &other) = delete;
-  Network &operator=(const Network &other) = delete;
+  Network(const Network &other) { *this = other; }
+
+  // a deep copy, plans are not shared but rebuilt lazily
+  Network &operator=(const Network &other) {
+    if (this != &other)
+      assign(other, true);
+    return *this;
+  }
+
+  // A copy for elitism and migration. Without traces it starts cleared,
+  // as after clear(), and connection traces are not copied at all.
+  Network clone(bool traces = true) const {
+    Network res;
+    res.assign(*this, traces);
+    return res;
+  }
 
   Network(Network &&other) noexcept
-      : _crossoverScore(other._crossoverScore), _fitness(other._fitness) {
+      : _crossoverScore(other._crossoverScore), _fitness(other._fitness),
+        _frozen(other._frozen), _planLive(other._planLive),
+        _autoCompact(other._autoCompact), _plain(other._plain),
+        _plainKnown(other._plainKnown), _plainPaths(other._plainPaths),
+        _tracesKnown(other._tracesKnown),
+        _weightStorage(other._weightStorage), _optimizer(other._optimizer) {
+    _plan.swap(other._plan);
+    other._planLive = false;
     _inputs.swap(other._inputs);
     _outputs.swap(other._outputs);
     _sortedNodes.swap(other._sortedNodes);
     _activeConns.swap(other._activeConns);
+    _edges.swap(other._edges);
     _nodes.swap(other._nodes);
     _connections.swap(other._connections);
     _weights.swap(other._weights);
+    std::swap(_gradients, other._gradients);
+    std::swap(_xtraces, other._xtraces);
     _unusedNodes.swap(other._unusedNodes);
     _unusedConns.swap(other._unusedConns);
     _unusedWeights.swap(other._unusedWeights);
   }
 
   Network &operator=(Network &&other) noexcept {
+    _plan.swap(other._plan);
+    std::swap(_frozen, other._frozen);
+    std::swap(_planLive, other._planLive);
+    std::swap(_autoCompact, other._autoCompact);
+    std::swap(_plain, other._plain);
+    std::swap(_plainKnown, other._plainKnown);
+    std::swap(_plainPaths, other._plainPaths);
+    std::swap(_tracesKnown, other._tracesKnown);
+    std::swap(_weightStorage, other._weightStorage);
+    std::swap(_optimizer, other._optimizer);
     _inputs.swap(other._inputs);
     _outputs.swap(other._outputs);
     _sortedNodes.swap(other._sortedNodes);
     _activeConns.swap(other._activeConns);
+    _edges.swap(other._edges);
     _nodes.swap(other._nodes);
     _connections.swap(other._connections);
     _weights.swap(other._weights);
+    std::swap(_gradients, other._gradients);
+    std::swap(_xtraces, other._xtraces);
     _unusedNodes.swap(other._unusedNodes);
     _unusedConns.swap(other._unusedConns);
     _unusedWeights.swap(other._unusedWeights);
@@ -72,6 +221,7 @@ public:
 
   template <typename SomeFloat, typename SomeFloatVector>
   void activate(const SomeFloatVector &input, std::vector<SomeFloat> &output) {
+    flushPlan();
     output.clear();
 
     auto isize = input.size();
@@ -81,18 +231,22 @@ public:
           "network input size.");
 
     for (size_t i = 0; i < isize; i++) {
-      _inputs[i].get().setInput(input[i]);
+      std::get<InputNode>(_nodes[_inputs[i]]).setInput(input[i]);
     }
 
-    for (auto &rnode : _sortedNodes) {
-      auto &vnode = rnode.get();
+    const auto plainPath = plain();
+    if (!plainPath)
+      traces();
+    const auto g = graph();
+    for (auto idx : _sortedNodes) {
       std::visit(
-          [&output](auto &&node) {
-            auto activation = node.activate();
+          [&](auto &&node) {
+            auto activation =
+                plainPath ? node.activatePlain(g) : node.activate(g, idx);
             if (node.isOutput())
               output.push_back(activation);
           },
-          vnode);
+          _nodes[idx]);
     }
   }
 
@@ -105,6 +259,12 @@ public:
   template <typename SomeFloat, typename SomeFloatVector>
   void activateFast(const SomeFloatVector &input,
                     std::vector<SomeFloat> &output) {
+    if (_frozen) {
+      plan().activate(input, output);
+      return;
+    }
+
+    flushPlan();
     output.clear();
 
     auto isize = input.size();
@@ -114,18 +274,18 @@ public:
           "network input size.");
 
     for (size_t i = 0; i < isize; i++) {
-      _inputs[i].get().setInput(input[i]);
+      std::get<InputNode>(_nodes[_inputs[i]]).setInput(input[i]);
     }
 
-    for (auto &rnode : _sortedNodes) {
-      auto &vnode = rnode.get();
+    const auto g = graph();
+    for (auto idx : _sortedNodes) {
       std::visit(
-          [&output](auto &&node) {
-            auto activation = node.activateFast();
+          [&](auto &&node) {
+            auto activation = node.activateFast(g);
             if (node.isOutput())
               output.push_back(activation);
           },
-          vnode);
+          _nodes[idx]);
     }
   }
 
@@ -135,25 +295,72 @@ public:
     return _outputCache;
   }
 
+  // Activates n samples, rows of stride floats starting at inputs,
+  // writing n rows of outputs count floats.
+  // Same results of calling activateFast n times, but feedforward networks
+  // are swept once for the whole batch.
+  // Unfrozen networks compile a plan for each call, freeze() keeps it.
+  void activateBatch(const float *inputs, size_t n, size_t stride,
+                     float *outputs) {
+    checkBatch(stride);
+    withPlan([&](ActivationPlan &plan) {
+      plan.activateBatch(inputs, n, stride, outputs);
+    });
+  }
+
+  // Like activateBatch but samples are always independent of each other,
+  // recurrent connections see the state from before the batch.
+  void activateBatchFeedforward(const float *inputs, size_t n, size_t stride,
+                                float *outputs) {
+    checkBatch(stride);
+    withPlan([&](ActivationPlan &plan) {
+      plan.activateBatchFeedforward(inputs, n, stride, outputs);
+    });
+  }
+
   template <typename SomeFloat, typename SomeFloatVector>
   SomeFloat propagate(const SomeFloatVector &targets, double rate = 0.3,
                       double momentum = 0.0, bool update = true) {
+    if (update) {
+      // weights and biases are going to change
+      invalidate();
+      _gradients.connectionDeltas.resize(_connections.size(), NeuroFloat(0));
+      _gradients.biasDeltas.resize(_nodes.size(), NeuroFloat(0));
+    } else {
+      // gradients pile up until applyGradients()
+      flushPlan();
+      _gradients.weights.resize(_weights.size(), NeuroFloat(0));
+      _gradients.biases.resize(_nodes.size(), NeuroFloat(0));
+      _gradients.samples++;
+    }
+
     size_t outputIdx = targets.size();
     _outputCache.resize(outputIdx); // reuse for MSE
+    const auto plainPath = plain();
+    if (!plainPath)
+      traces();
+    const auto g = graph();
     for (auto it = _sortedNodes.rbegin(); it != _sortedNodes.rend(); ++it) {
-      auto &vnode = (*it).get();
+      const auto idx = *it;
       std::visit(
           [&](auto &&node) {
             if (node.isOutput()) {
               outputIdx--;
-              node.propagate(rate, momentum, update, targets[outputIdx]);
+              if (plainPath)
+                node.propagatePlain(g, idx, rate, momentum, update,
+                                    targets[outputIdx]);
+              else
+                node.propagate(g, idx, rate, momentum, update,
+                               targets[outputIdx]);
               _outputCache[outputIdx] =
                   std::pow(node.current() - targets[outputIdx], 2);
+            } else if (plainPath) {
+              node.propagatePlain(g, idx, rate, momentum, update);
             } else {
-              node.propagate(rate, momentum, update);
+              node.propagate(g, idx, rate, momentum, update);
             }
           },
-          vnode);
+          _nodes[idx]);
     }
     NeuroFloat mean = 0;
     for (auto err : _outputCache) {
@@ -172,41 +379,158 @@ public:
   }
 
   void clear() {
+    flushPlan();
+    const auto g = graph();
     for (auto &node : _nodes) {
-      std::visit([](auto &&node) { node.clear(); }, node);
+      std::visit([&](auto &&node) { node.clear(g); }, node);
+    }
+    std::fill(_xtraces.values.begin(), _xtraces.values.end(), NeuroFloat(0));
+  }
+
+  // Applies the mean gradient of the samples propagated with update off
+  // through the optimizer, its moments are kept per weight and per bias.
+  // Mutations and compact() drop pending gradients along with the moments.
+  // Adam takes momentum as beta1, which must be in [0, 1).
+  void applyGradients(double rate, double momentum = 0.0) {
+    if (_optimizer == Optimizer::Adam && !(momentum >= 0.0 && momentum < 1.0))
+      throw std::runtime_error("Adam momentum must be in [0, 1).");
+
+    if (_gradients.samples == 0)
+      return;
+
+    invalidate();
+
+    auto &grads = _gradients;
+    grads.updates++;
+    const OptimizerStep step(_optimizer, rate, momentum, grads.samples,
+                             grads.updates);
+    grads.weightSteps.resize(grads.weights.size(), NeuroFloat(0));
+    grads.biasSteps.resize(grads.biases.size(), NeuroFloat(0));
+    if (step.usesSquares()) {
+      grads.weightSquares.resize(grads.weights.size(), NeuroFloat(0));
+      grads.biasSquares.resize(grads.biases.size(), NeuroFloat(0));
+    }
+    step.run(grads.weights.data(), grads.weightSteps.data(),
+             grads.weightSquares.data(), grads.weights.size());
+    step.run(grads.biases.data(), grads.biasSteps.data(),
+             grads.biasSquares.data(), grads.biases.size());
+
+    for (size_t i = 0; i < grads.weights.size(); i++) {
+      if (_weights[i].second)
+        _weights.mut(i).first += grads.weights[i];
+      grads.weights[i] = 0;
+    }
+
+    for (auto idx : _sortedNodes) {
+      auto hidden = std::get_if<HiddenNode>(&_nodes[idx]);
+      if (hidden)
+        hidden->setBias(hidden->bias() + grads.biases[idx]);
+    }
+    std::fill(grads.biases.begin(), grads.biases.end(), NeuroFloat(0));
+
+    grads.samples = 0;
+  }
+
+  // Moments of the previous optimizer are dropped.
+  void setOptimizer(Optimizer optimizer) {
+    _optimizer = optimizer;
+    auto &grads = _gradients;
+    grads.weightSteps.clear();
+    grads.biasSteps.clear();
+    grads.weightSquares.clear();
+    grads.biasSquares.clear();
+    grads.updates = 0;
+  }
+
+  Optimizer optimizer() const { return _optimizer; }
+
+  // Drops pending gradients, momentum is kept.
+  void clearGradients() {
+    auto &grads = _gradients;
+    std::fill(grads.weights.begin(), grads.weights.end(), NeuroFloat(0));
+    std::fill(grads.biases.begin(), grads.biases.end(), NeuroFloat(0));
+    grads.samples = 0;
+  }
+
+  // Adds the pending gradients of a copy of this network, as from clone(),
+  // to ours and clears them there.
+  void mergeGradients(Network &other) {
+    auto &src = other._gradients;
+    if (src.samples == 0)
+      return;
+
+    auto &dst = _gradients;
+    if (src.weights.size() != _weights.size() ||
+        src.biases.size() != _nodes.size())
+      throw std::runtime_error("Gradients do not match this network.");
+
+    dst.weights.resize(src.weights.size(), NeuroFloat(0));
+    dst.biases.resize(src.biases.size(), NeuroFloat(0));
+    for (size_t i = 0; i < src.weights.size(); i++) {
+      dst.weights[i] += src.weights[i];
+      src.weights[i] = 0;
     }
+    for (size_t i = 0; i < src.biases.size(); i++) {
+      dst.biases[i] += src.biases[i];
+      src.biases[i] = 0;
+    }
+    dst.samples += src.samples;
+    src.samples = 0;
   }
 
+  // Takes weights and biases from a copy of this network, weight pages end
+  // up shared with it. Activation state and traces stay ours.
+  void syncParameters(const Network &other) {
+    if (other._nodes.size() != _nodes.size() ||
+        other._weights.size() != _weights.size())
+      throw std::runtime_error("Networks differ in structure.");
+
+    invalidate();
+    _weights = other._weights;
+    for (auto idx : _sortedNodes) {
+      auto hidden = std::get_if<HiddenNode>(&_nodes[idx]);
+      if (hidden)
+        hidden->setBias(std::get<HiddenNode>(other._nodes[idx]).bias());
+    }
+  }
+
+  // Node, connection and weight indices stay valid across mutations unless
+  // auto compaction is on, see setAutoCompact().
   void mutate(const std::vector<NetworkMutations> &network_pool,
               double network_rate, const std::vector<NodeMutations> &node_pool,
               double node_rate, double weight_rate) {
     LOG(TRACE) << "Network mutate start...";
 
-    for (auto &node : _sortedNodes) {
-      for (auto mutation : node_pool) {
-        auto chance = Random::nextDouble();
-        if (chance < node_rate) {
-          std::visit([mutation](auto &&node) { node.mutate(mutation); },
-                     node.get());
-        }
-      }
+    invalidate();
+    // slots get recycled and renumbered
+    dropBatch();
+    _plainKnown = false;
+    _tracesKnown = false;
+
+    // every node pairs with every node mutation
+    const auto npool = node_pool.size();
+    sample(_sortedNodes.size() * npool, node_rate, [&](size_t i) {
+      auto mutation = node_pool[i % npool];
+      std::visit([mutation](auto &&node) { node.mutate(mutation); },
+                 _nodes[_sortedNodes[i / npool]]);
+    });
+
+    // hits on unused slots are dropped, used ones still go at weight_rate
+    // and only the pages actually mutated stop being shared
+    if (weight_rate >= DenseMutationRate) {
+      mutateWeightsDense(weight_rate);
+    } else {
+      sample(_weights.size(), weight_rate, [&](size_t i) {
+        if (_weights[i].second)
+          _weights.mut(i).first += Random::adjust();
+      });
     }
 
-    for (auto &weight : _weights) {
-      if (!weight.second.empty()) {
-        auto chance = Random::nextDouble();
-        if (chance < weight_rate) {
-          weight.first += Random::adjust();
-        }
-      }
-    }
+    sample(network_pool.size(), network_rate,
+           [&](size_t i) { doMutation(network_pool[i]); });
 
-    for (auto mutation : network_pool) {
-      auto chance = Random::nextDouble();
-      if (chance < network_rate) {
-        doMutation(mutation);
-      }
-    }
+    if (_autoCompact && needsCompact())
+      compact();
 
     LOG(TRACE) << "Network mutate end.";
   }
@@ -215,14 +539,19 @@ public:
     return std::visit([](auto &&n) { return (Node *)&n; }, node);
   }
 
-  static Node *getNodePtr(std::reference_wrapper<AnyNode> &node) {
-    return std::visit([](auto &&n) { return (Node *)&n; }, node.get());
+  static const Node *getNodePtr(const AnyNode &node) {
+    return std::visit([](auto &&n) { return (const Node *)&n; }, node);
   }
 
   static Network crossover(const Network &net1, const Network &net2) {
     LOG(TRACE) << "Network crossover start...";
 
+    net1.flushPlan();
+    net2.flushPlan();
+
     Network res{};
+    res._weightStorage = net1._weightStorage;
+    res._optimizer = net1._optimizer;
     hash_combine(res._crossoverScore, net1._crossoverScore);
     hash_combine(res._crossoverScore, net2._crossoverScore);
 
@@ -241,29 +570,27 @@ public:
                                                 : net2._sortedNodes.size();
 
     auto &mainnet = net1._fitness > net2._fitness ? net1 : net2;
-    for (size_t i = 0; i < newLen; i++) {
-      auto &mainnode = mainnet._sortedNodes[i].get();
-      auto mainIsOutput =
-          std::visit([](auto &&n) { return n.isOutput(); }, mainnode);
+    for (uint32_t i = 0; i < newLen; i++) {
+      auto &mainnode = mainnet._nodes[mainnet._sortedNodes[i]];
+      auto mainIsOutput = getNodePtr(mainnode)->isOutput();
       auto &newNode = res._nodes.emplace_back();
-      res._sortedNodes.emplace_back(newNode);
+      res._sortedNodes.emplace_back(i);
       if (mainnode.index() == 0 || mainIsOutput) {
         // if input or output use main as it's the closest architecture
         newNode =
             std::visit([](auto &&n) { return AnyNode(n.clone()); }, mainnode);
         if (mainnode.index() == 0)
-          res._inputs.emplace_back(std::get<InputNode>(newNode));
+          res._inputs.emplace_back(i);
         if (mainIsOutput)
-          res._outputs.emplace_back(newNode);
+          res._outputs.emplace_back(i);
       } else {
         auto &parent = Random::nextDouble() < 0.5 ? net1 : net2;
         auto &node = i < parent._sortedNodes.size()
-                         ? parent._sortedNodes[i].get()
-                         : mainnet._sortedNodes[i].get();
+                         ? parent._nodes[parent._sortedNodes[i]]
+                         : mainnode;
 
         // input and outputs are already dealt with
-        if (node.index() == 0 ||
-            std::visit([](auto &&n) { return n.isOutput(); }, node)) {
+        if (node.index() == 0 || getNodePtr(node)->isOutput()) {
           // fall back to mainnode
           newNode =
               std::visit([](auto &&n) { return AnyNode(n.clone()); }, mainnode);
@@ -279,56 +606,43 @@ public:
     // shared as in topology
 
     struct ConnData {
-      const Connection *conn;
-      size_t fidx;
-      size_t tidx;
-      size_t gidx;
+      bool gated;
+      NeuroFloat weight;
+      uint32_t fidx;
+      uint32_t tidx;
+      uint32_t gidx;
     };
 
     std::vector<ConnData> connections;
 
     {
-      std::map<size_t, ConnData> conns1;
-      std::map<size_t, ConnData> conns2;
-      {
-        std::unordered_map<const Node *, uint64_t> nodeMap1;
-        uint64_t idx = 0;
-        for (auto &node : net1._sortedNodes) {
-          nodeMap1.emplace(getNodePtr(node), idx);
-          idx++;
+      auto collect = [](const Network &net) {
+        // sorted positions of the nodes
+        std::vector<uint32_t> nodeMap(net._nodes.size(), 0);
+        for (uint32_t i = 0; i < net._sortedNodes.size(); i++) {
+          nodeMap[net._sortedNodes[i]] = i;
         }
 
-        std::unordered_map<const Node *, uint64_t> nodeMap2;
-        idx = 0;
-        for (auto &node : net2._sortedNodes) {
-          nodeMap2.emplace(getNodePtr(node), idx);
-          idx++;
-        }
-
-        for (auto &conn : net1._activeConns) {
-          auto fidx = nodeMap1[conn->from];
-          auto tidx = nodeMap1[conn->to];
-          auto gidx = conn->gater ? nodeMap1[conn->gater] : 0;
+        std::map<size_t, ConnData> conns;
+        for (auto c : net._activeConns) {
+          auto &conn = net._connections[c];
+          auto fidx = nodeMap[conn.from];
+          auto tidx = nodeMap[conn.to];
+          auto gated = conn.gater != NoIndex;
+          auto gidx = gated ? nodeMap[conn.gater] : 0;
           size_t id = 0;
           hash_combine(id, fidx);
           hash_combine(id, tidx);
-          auto [_, added] =
-              conns1.emplace(id, ConnData{conn, fidx, tidx, gidx});
+          auto [_, added] = conns.emplace(
+              id, ConnData{gated, net._weights[conn.weight].first, fidx, tidx,
+                           gidx});
           assert(added); // likely there is a bug somewhere
         }
+        return conns;
+      };
 
-        for (auto &conn : net2._activeConns) {
-          auto fidx = nodeMap2[conn->from];
-          auto tidx = nodeMap2[conn->to];
-          auto gidx = conn->gater ? nodeMap1[conn->gater] : 0;
-          size_t id = 0;
-          hash_combine(id, fidx);
-          hash_combine(id, tidx);
-          auto [_, added] =
-              conns2.emplace(id, ConnData{conn, fidx, tidx, gidx});
-          assert(added); // likely there is a bug somewhere
-        }
-      }
+      auto conns1 = collect(net1);
+      auto conns2 = collect(net2);
 
       auto &primary = net1._fitness > net2._fitness ? conns1 : conns2;
       auto &secondary = net1._fitness > net2._fitness ? conns2 : conns1;
@@ -340,107 +654,141 @@ public:
           // so we can pick from the other net
           if (Random::nextDouble() < 0.5) {
             connections.emplace_back(v);
-            auto &w = res._weights.emplace_back(*v.conn->weight);
-            w.second.clear();
           } else {
             connections.emplace_back(sit->second);
-            auto &w = res._weights.emplace_back(*sit->second.conn->weight);
-            w.second.clear();
           }
         } else {
           LOG(TRACE) << "Crossover, adding non shared connection " << k;
           // let the strongest win if not shared
           connections.emplace_back(v);
-          auto &w = res._weights.emplace_back(*v.conn->weight);
-          w.second.clear();
         }
       }
     }
 
-    auto widx = 0;
     const auto nsize = res._sortedNodes.size();
     for (auto &conn : connections) {
-      auto &nc = res.connect(res._sortedNodes[conn.fidx].get(),
-                             res._sortedNodes[conn.tidx].get());
-      if (conn.conn->gater && conn.gidx < nsize) {
-        res.gate(res._sortedNodes[conn.gidx].get(), nc);
+      auto c = res.connect(conn.fidx, conn.tidx);
+      if (conn.gated && conn.gidx < nsize) {
+        res.gate(conn.gidx, c);
       }
-      nc.weight = &res._weights[widx];
-      res._weights[widx].second.insert(&nc);
-      widx++;
+      res.addWeight(c, conn.weight);
     }
 
     LOG(TRACE) << "Network crossover end.";
 
     // sanity on the first input node
-    assert(&res._sortedNodes[0].get() == &res._nodes[0]);
+    assert(res._sortedNodes[0] == 0);
 
     return res;
   }
 
   template <class Archive>
   void save(Archive &ar, std::uint32_t const version) const {
-    std::unordered_map<const Node *, uint64_t> nodeMap;
+    // slots are renumbered, sorted nodes first and unused ones left out
+    std::vector<uint64_t> nodeMap(_nodes.size(), 0);
     std::vector<AnyNode> nodes;
     std::vector<uint64_t> inputs;
     std::vector<ConnectionInfo> conns;
     std::vector<NeuroFloat> weights;
 
     uint64_t idx = 0;
-    for (auto &node : _sortedNodes) {
-      nodeMap.emplace(getNodePtr(node), idx++);
-      nodes.emplace_back(node.get());
+    for (auto node : _sortedNodes) {
+      nodeMap[node] = idx++;
+      auto &saved = nodes.emplace_back(_nodes[node]);
+      if (saved.index() == 1) {
+        auto &hidden = std::get<HiddenNode>(saved);
+        hidden.setBias(PackedWeight::round(_weightStorage, hidden.bias()));
+      }
     }
 
     // from now on we will also ignore
     // unused weights and connection slots
 
-    std::unordered_map<const Weight *, uint64_t> wMap;
+    std::vector<uint64_t> wMap(_weights.size(), 0);
     idx = 0;
-    for (auto &w : _weights) {
-      if (w.second.size() != 0) {
-        wMap.emplace(&w, idx++);
+    for (size_t i = 0; i < _weights.size(); i++) {
+      auto &w = _weights[i];
+      if (w.second) {
+        wMap[i] = idx++;
         weights.push_back(w.first);
         LOG(TRACE) << "Weight " << w.first;
       }
     }
 
-    for (auto &conn : _activeConns) {
-      LOG(TRACE) << "Saving " << nodeMap[conn->from] << " -> "
-                 << nodeMap[conn->to] << " g " << nodeMap[conn->gater] << " w "
-                 << wMap[conn->weight] << " hg " << (conn->gater != nullptr);
-      conns.push_back({nodeMap[conn->from], nodeMap[conn->to],
-                       conn->gater != nullptr, nodeMap[conn->gater],
-                       wMap[conn->weight]});
+    for (auto c : _activeConns) {
+      auto &conn = _connections[c];
+      auto hasGater = conn.gater != NoIndex;
+      auto gater = hasGater ? nodeMap[conn.gater] : 0;
+      LOG(TRACE) << "Saving " << nodeMap[conn.from] << " -> "
+                 << nodeMap[conn.to] << " g " << gater << " w "
+                 << wMap[conn.weight] << " hg " << hasGater;
+      conns.push_back({nodeMap[conn.from], nodeMap[conn.to], hasGater, gater,
+                       wMap[conn.weight]});
     }
 
-    for (auto &inp : _inputs) {
-      LOG(TRACE) << "Input " << nodeMap[&inp.get()];
-      inputs.emplace_back(nodeMap[&inp.get()]);
+    for (auto inp : _inputs) {
+      LOG(TRACE) << "Input " << nodeMap[inp];
+      inputs.emplace_back(nodeMap[inp]);
     }
 
-    ar(nodes, weights, conns, inputs);
+    if (version < 2) {
+      // older format, no storage (values are rounded anyway)
+      for (auto &w : weights) {
+        w = PackedWeight::round(_weightStorage, w);
+      }
+      ar(nodes, weights, conns, inputs);
+    } else if (_weightStorage == WeightStorage::Float) {
+      ar(nodes, conns, inputs, _weightStorage, weights);
+    } else {
+      std::vector<uint16_t> packed(weights.size() * PackedWeight::Lanes);
+      for (size_t i = 0; i < weights.size(); i++) {
+        PackedWeight::pack(_weightStorage, weights[i],
+                           &packed[i * PackedWeight::Lanes]);
+      }
+      ar(nodes, conns, inputs, _weightStorage, packed);
+    }
   }
 
   template <class Archive> void load(Archive &ar, std::uint32_t const version) {
+    invalidate();
+    _plainKnown = false;
+    _tracesKnown = false;
+    _xtraces = XTraces();
+
     std::vector<AnyNode> nodes;
     std::vector<uint64_t> inputs;
     std::vector<ConnectionInfo> conns;
     std::vector<NeuroFloat> weights;
 
-    ar(nodes, weights, conns, inputs);
+    if (version < 2) {
+      ar(nodes, weights, conns, inputs);
+    } else {
+      ar(nodes, conns, inputs, _weightStorage);
+      if (_weightStorage == WeightStorage::Float) {
+        ar(weights);
+      } else {
+        std::vector<uint16_t> packed;
+        ar(packed);
+        weights.resize(packed.size() / PackedWeight::Lanes);
+        for (size_t i = 0; i < weights.size(); i++) {
+          weights[i] = PackedWeight::unpack(_weightStorage,
+                                            &packed[i * PackedWeight::Lanes]);
+        }
+      }
+    }
 
     for (auto &node : nodes) {
-      auto &nref = _nodes.emplace_back(node);
-      _sortedNodes.emplace_back(nref);
-      if (getNodePtr(nref)->isOutput()) {
-        _outputs.emplace_back(nref);
+      auto idx = uint32_t(_nodes.size());
+      _nodes.emplace_back(std::move(node));
+      _sortedNodes.emplace_back(idx);
+      if (getNodePtr(_nodes[idx])->isOutput()) {
+        _outputs.emplace_back(idx);
       }
     }
 
     for (auto idx : inputs) {
       LOG(TRACE) << "Input " << idx;
-      _inputs.emplace_back(std::get<InputNode>(_sortedNodes[idx].get()));
+      _inputs.emplace_back(_sortedNodes[idx]);
     }
 
     for (auto &wval : weights) {
@@ -453,13 +801,11 @@ public:
       LOG(TRACE) << "Loading " << conn.fromIdx << " -> " << conn.toIdx << " g "
                  << conn.gaterIdx << " w " << conn.weightIdx << " hg "
                  << conn.hasGater;
-      auto &c = connect(_sortedNodes[conn.fromIdx].get(),
-                        _sortedNodes[conn.toIdx].get());
+      auto c = connect(_sortedNodes[conn.fromIdx], _sortedNodes[conn.toIdx]);
       if (conn.hasGater)
-        gate(_sortedNodes[conn.gaterIdx].get(), c);
-      auto &w = _weights[conn.weightIdx];
-      w.second.insert(&c);
-      c.weight = &w;
+        gate(_sortedNodes[conn.gaterIdx], c);
+      _weights.mut(conn.weightIdx).second++;
+      _connections[c].weight = uint32_t(conn.weightIdx);
     }
   }
 
@@ -476,14 +822,191 @@ public:
     }
   };
 
-  std::deque<Weight> &weights() { return _weights; }
+  WeightVector &weights() {
+    // might be edited from outside
+    invalidate();
+    return _weights;
+  }
 
-  const std::deque<Connection> &connections() { return _connections; }
+  const std::vector<Connection> &connections() {
+    flushPlan();
+    return _connections;
+  }
 
-  const std::vector<std::reference_wrapper<AnyNode>> &nodes() {
+  // indices of the active nodes in activation order, see node()
+  const std::vector<uint32_t> &nodes() {
+    flushPlan();
     return _sortedNodes;
   }
 
+  AnyNode &node(uint32_t idx) {
+    // might be edited from outside
+    invalidate();
+    return _nodes[idx];
+  }
+
+  // Freezing compiles the network into a flat ActivationPlan
+  // which from now on backs activateFast.
+  // Any change to the graph, weights or biases invalidates the plan
+  // and it will be recompiled lazily on the next activateFast.
+  void freeze() {
+    _frozen = true;
+    plan();
+  }
+
+  void unfreeze() {
+    invalidate();
+    _frozen = false;
+  }
+
+  bool frozen() const { return _frozen; }
+
+  // the plan backing activateFast, to inspect how it runs
+  const ActivationPlan &frozenPlan() {
+    if (!_frozen)
+      throw std::runtime_error("Network is not frozen, it has no plan.");
+    return plan();
+  }
+
+  // No gates, no self connections and every connection going forward in
+  // activation order. activate() and propagate() skip eligibility traces
+  // on such networks, results are the same. See setPlainPaths().
+  bool plain() {
+    if (!_plainKnown) {
+      _plain = checkPlain();
+      _plainKnown = true;
+    }
+    return _plain;
+  }
+
+  // Trace slots for the current topology, laid out again after structural
+  // changes. Slots keep the traces of their connection and gated node.
+  const XTraces &traces() {
+    if (_tracesKnown)
+      return _xtraces;
+
+    XTraces res;
+    res.firstTarget.resize(_nodes.size() + 1);
+    res.targetOf.resize(_connections.size(), NoIndex);
+    for (uint32_t idx = 0; idx < _nodes.size(); idx++) {
+      const auto first = uint32_t(res.targets.size());
+      res.firstTarget[idx] = first;
+      for (auto c : getNodePtr(_nodes[idx])->connections().gate) {
+        const auto to = _connections[c].to;
+        auto pos =
+            std::find(res.targets.begin() + first, res.targets.end(), to);
+        res.targetOf[c] = uint32_t(pos - res.targets.begin());
+        if (pos == res.targets.end()) {
+          res.targets.push_back(to);
+          res.selfs.push_back(getNodePtr(_nodes[to])->connections().self);
+        }
+      }
+    }
+    res.firstTarget.back() = uint32_t(res.targets.size());
+    res.influence.resize(res.targets.size(), NeuroFloat(0));
+    res.decay.resize(res.targets.size(), NeuroFloat(0));
+
+    const auto &old = _xtraces;
+    res.firstSlot.resize(_connections.size() + 1);
+    for (uint32_t c = 0; c < _connections.size(); c++) {
+      res.firstSlot[c] = uint32_t(res.nodes.size());
+      const auto &conn = _connections[c];
+      if (conn.active == NoIndex || conn.from == conn.to)
+        continue;
+
+      for (auto t = res.firstTarget[conn.to]; t < res.firstTarget[conn.to + 1];
+           t++) {
+        const auto node = res.targets[t];
+        NeuroFloat value(0);
+        if (c + 1 < old.firstSlot.size()) {
+          for (auto slot = old.firstSlot[c]; slot < old.firstSlot[c + 1];
+               slot++) {
+            if (old.nodes[slot] == node)
+              value = old.values[slot];
+          }
+        }
+        res.nodes.push_back(node);
+        res.values.push_back(value);
+      }
+    }
+    res.firstSlot.back() = uint32_t(res.nodes.size());
+
+    _xtraces = std::move(res);
+    _tracesKnown = true;
+    return _xtraces;
+  }
+
+  // With plain paths disabled no network counts as plain.
+  void setPlainPaths(bool enabled) {
+    _plainPaths = enabled;
+    _plainKnown = false;
+  }
+
+  // Frozen plans and saved models keep weights and biases in storage,
+  // see WeightStorage. Nothing is rounded until then.
+  void setWeightStorage(WeightStorage storage) {
+    invalidate();
+    _weightStorage = storage;
+  }
+
+  WeightStorage weightStorage() const { return _weightStorage; }
+
+#ifndef NEVOLVER_WIDE
+  // Writes the forward pass as a standalone C source, see SourceExporter.
+  // name prefixes every exported symbol and must be a valid identifier.
+  void exportSource(std::ostream &os, const std::string &name) {
+    withPlan(
+        [&](ActivationPlan &plan) { SourceExporter::write(plan, os, name); });
+  }
+
+  // An int8 copy of the forward pass, see QuantizedPlan.
+  // calibration inputs are run from a cleared state to find activation
+  // ranges, the network is cleared again afterwards.
+  QuantizedPlan
+  quantize(const std::vector<std::vector<NeuroFloat>> &calibration) {
+    clear();
+    auto res = withPlan([&](ActivationPlan &plan) {
+      return QuantizedPlan(plan, calibration);
+    });
+    clear();
+    return res;
+  }
+
+  // Runs inputs through both the network and quantized from a cleared state
+  // and reports how far the quantized outputs are.
+  QuantizedPlan::Report
+  compare(QuantizedPlan &quantized,
+          const std::vector<std::vector<NeuroFloat>> &inputs) {
+    QuantizedPlan::Report report;
+    report.maxErrors.resize(_outputs.size(), 0.0);
+
+    clear();
+    quantized.reset();
+    std::vector<NeuroFloat> expected, actual;
+    double sum = 0.0, sum2 = 0.0;
+    for (auto &input : inputs) {
+      activateFast(input, expected);
+      quantized.activate(input, actual);
+      for (size_t o = 0; o < expected.size(); o++) {
+        auto error = std::fabs(double(actual[o]) - double(expected[o]));
+        report.maxErrors[o] = std::max(report.maxErrors[o], error);
+        report.maxError = std::max(report.maxError, error);
+        sum += error;
+        sum2 += error * error;
+      }
+      report.samples++;
+    }
+    clear();
+
+    const auto count = double(report.samples * _outputs.size());
+    if (count > 0.0) {
+      report.meanError = sum / count;
+      report.rmsError = std::sqrt(sum2 / count);
+    }
+    return report;
+  }
+#endif
+
   struct Stats {
     size_t activeNodes;
     size_t activeConnections;
@@ -491,6 +1014,8 @@ public:
     size_t unusedNodes;
     size_t unusedConnections;
     size_t unusedWeights;
+    // weight pages still shared with copies of this network
+    size_t sharedWeightPages;
     size_t crossoverScore;
   };
 
@@ -502,6 +1027,7 @@ public:
     stats.unusedNodes = _unusedNodes.size();
     stats.unusedConnections = _unusedConns.size();
     stats.unusedWeights = _unusedWeights.size();
+    stats.sharedWeightPages = _weights.sharedPages();
     stats.crossoverScore = _crossoverScore;
     return stats;
   }
@@ -514,67 +1040,392 @@ public:
     std::cout << "Unused-Nodes: " << _unusedNodes.size() << "\n";
     std::cout << "Unused-Connections: " << _unusedConns.size() << "\n";
     std::cout << "Unused-Weights: " << _unusedWeights.size() << "\n";
+    std::cout << "Shared-Weight-Pages: " << _weights.sharedPages() << "/"
+              << _weights.pages() << "\n";
   }
 
   template <typename NodesIterator>
   NodesIterator removeNode(NodesIterator &nit) {
-    AnyNode &node = (*nit).get();
+    invalidate();
+
+    const auto idx = *nit;
+    AnyNode &node = _nodes[idx];
     if (node.index() == 0)
       return ++nit; // don't remove inputs
 
-    const Node *nptr = getNodePtr(node);
-
-    if (nptr->isOutput())
+    if (getNodePtr(node)->isOutput())
       return ++nit; // don't remove outputs
 
-    cleanupNode(node);
+    cleanupNode(idx);
+    _unusedNodes.push_back(idx);
 
-    // need to erase from sorted
-    // this will shift ptrs around
-    auto sit = _nodes.begin();
-    while (sit != _nodes.end()) {
-      auto &inode = *sit;
-      if (&inode == &node) {
-        auto idx = std::distance(_nodes.begin(), sit);
-        _unusedNodes.push_back(idx);
-        break;
+    return _sortedNodes.erase(nit);
+  }
+
+  // Drops recycled slots and lays nodes out in activation order, each one
+  // followed by its inbound connections, weights in first use order.
+  // Everything is renumbered, indices taken from nodes() become stale.
+  void compact() {
+    invalidate();
+    dropBatch();
+    _plainKnown = false;
+    _tracesKnown = false;
+
+    std::vector<uint32_t> nodeMap(_nodes.size(), NoIndex);
+    for (uint32_t i = 0; i < _sortedNodes.size(); i++) {
+      nodeMap[_sortedNodes[i]] = i;
+    }
+
+    std::vector<uint32_t> connMap(_connections.size(), NoIndex);
+    std::vector<uint32_t> weightMap(_weights.size(), NoIndex);
+    std::vector<Connection> connections;
+    WeightVector weights;
+    connections.reserve(_activeConns.size());
+    weights.reserve(_weights.size() - _unusedWeights.size());
+
+    // traces move along with their connections, the ones left behind by
+    // removed nodes go away
+    XTraces moved;
+    const auto &oldTraces = _xtraces;
+    auto relay = [&](uint32_t cidx) {
+      if (!oldTraces.firstSlot.empty()) {
+        moved.firstSlot.push_back(uint32_t(moved.nodes.size()));
+        if (cidx + 1 < oldTraces.firstSlot.size()) {
+          for (auto slot = oldTraces.firstSlot[cidx];
+               slot < oldTraces.firstSlot[cidx + 1]; slot++) {
+            const auto node = nodeMap[oldTraces.nodes[slot]];
+            if (node != NoIndex) {
+              moved.nodes.push_back(node);
+              moved.values.push_back(oldTraces.values[slot]);
+            }
+          }
+        }
+      }
+
+      connMap[cidx] = uint32_t(connections.size());
+      auto &conn = connections.emplace_back(std::move(_connections[cidx]));
+      conn.from = nodeMap[conn.from];
+      conn.to = nodeMap[conn.to];
+      if (conn.gater != NoIndex)
+        conn.gater = nodeMap[conn.gater];
+      conn.active = connMap[cidx];
+
+      if (weightMap[conn.weight] == NoIndex) {
+        weightMap[conn.weight] = uint32_t(weights.size());
+        weights.push_back(_weights[conn.weight]);
+      }
+      conn.weight = weightMap[conn.weight];
+    };
+
+    // every active connection is the inbound or self one of its target
+    for (auto idx : _sortedNodes) {
+      const auto &links = getNodePtr(_nodes[idx])->connections();
+      if (links.self != NoIndex)
+        relay(links.self);
+      for (auto cidx : links.inbound) {
+        relay(cidx);
       }
-      ++sit;
     }
+    assert(connections.size() == _activeConns.size());
+    if (!moved.firstSlot.empty())
+      moved.firstSlot.push_back(uint32_t(moved.nodes.size()));
 
-    return _sortedNodes.erase(nit);
+    std::vector<AnyNode> nodes;
+    nodes.reserve(_sortedNodes.size());
+    for (auto idx : _sortedNodes) {
+      getNodePtr(nodes.emplace_back(std::move(_nodes[idx])))
+          ->remapConnections(connMap);
+    }
+
+    for (auto &idx : _inputs) {
+      idx = nodeMap[idx];
+    }
+    for (auto &idx : _outputs) {
+      idx = nodeMap[idx];
+    }
+    for (uint32_t i = 0; i < _sortedNodes.size(); i++) {
+      _sortedNodes[i] = i;
+    }
+
+    _edges.clear();
+    _edges.reserve(connections.size());
+    for (uint32_t i = 0; i < connections.size(); i++) {
+      _activeConns[i] = i;
+      _edges.assign(edgeKey(connections[i].from, connections[i].to), i);
+    }
+
+    // online deltas follow their connections and nodes
+    auto renumber = [](std::vector<NeuroFloat> &values,
+                       const std::vector<uint32_t> &map, size_t count) {
+      std::vector<NeuroFloat> res(values.empty() ? 0 : count, NeuroFloat(0));
+      for (size_t i = 0; i < values.size(); i++) {
+        if (map[i] != NoIndex)
+          res[map[i]] = values[i];
+      }
+      values.swap(res);
+    };
+    renumber(_gradients.connectionDeltas, connMap, connections.size());
+    renumber(_gradients.biasDeltas, nodeMap, nodes.size());
+
+    _nodes.swap(nodes);
+    _connections.swap(connections);
+    _weights.swap(weights);
+    _xtraces = std::move(moved);
+    _unusedNodes.clear();
+    _unusedConns.clear();
+    _unusedWeights.clear();
+  }
+
+  // Whether mutate() compacts the network once recycled slots outnumber
+  // live ones, small networks never trigger it. Off by default, compact()
+  // renumbers everything so node and connection indices held by the caller
+  // (from nodes(), connections() or connect()) would go stale after any
+  // mutate() call.
+  void setAutoCompact(bool enabled) { _autoCompact = enabled; }
+
+  bool autoCompact() const { return _autoCompact; }
+
+  bool needsCompact() {
+    const auto stats = getStats();
+    const auto unused =
+        stats.unusedNodes + stats.unusedConnections + stats.unusedWeights;
+    const auto active =
+        stats.activeNodes + stats.activeConnections + stats.activeWeights;
+    return unused >= CompactMinUnused && unused > active;
   }
 
 protected:
-  void cleanupNode(AnyNode &node) {
-    const Node *nptr = getNodePtr(node);
-    std::vector<Connection *> conns;
+  // from this weight rate on a sweep with bulk random numbers is cheaper
+  // than skipping from hit to hit
+  constexpr static double DenseMutationRate = 0.02;
+
+  // a chance for every weight slot, noise only for the hits
+  void mutateWeightsDense(double rate) {
+    constexpr size_t Lanes = sizeof(NeuroFloat) / sizeof(float);
+    constexpr size_t Chunk = 256;
+    float chances[Chunk];
+    uint32_t hits[Chunk];
+    float noise[Chunk * Lanes];
+
+    const auto threshold = float(rate);
+    for (size_t base = 0; base < _weights.size(); base += Chunk) {
+      const auto count = std::min(Chunk, _weights.size() - base);
+      Random::uniforms(chances, count);
+
+      size_t nhits = 0;
+      for (size_t i = 0; i < count; i++) {
+        hits[nhits] = uint32_t(base + i);
+        nhits += chances[i] < threshold;
+      }
+      // hits on unused slots are dropped
+      size_t used = 0;
+      for (size_t k = 0; k < nhits; k++) {
+        hits[used] = hits[k];
+        used += _weights[hits[k]].second != 0;
+      }
+      nhits = used;
 
-    // gates
-    // collect first
-    for (auto &conn : nptr->connections().gate) {
-      conns.push_back(conn);
+      Random::adjustments(noise, nhits * Lanes);
+      for (size_t k = 0; k < nhits; k++) {
+        NeuroFloat delta;
+        std::memcpy(&delta, &noise[k * Lanes], sizeof(NeuroFloat));
+        _weights.mut(hits[k]).first += delta;
+      }
     }
+  }
 
-    for (auto &conn : conns) {
-      ungate(node, *conn);
+  // calls f with the index of each of count trials hitting at rate
+  template <typename F> static void sample(size_t count, double rate, F f) {
+    for (auto i = Random::skip(rate); i < count;) {
+      f(i);
+      const auto gap = Random::skip(rate);
+      if (gap >= count - i - 1)
+        break;
+      i += gap + 1;
     }
+  }
 
-    // need to remove all connections
-    // collected them first then disconnect
-    conns.clear();
-    for (auto &conn : nptr->connections().outbound) {
-      conns.push_back(conn);
+  void assign(const Network &other, bool traces) {
+    invalidate();
+    other.flushPlan();
+    _frozen = other._frozen;
+    _autoCompact = other._autoCompact;
+    _plain = other._plain;
+    _plainKnown = other._plainKnown;
+    _plainPaths = other._plainPaths;
+    _tracesKnown = other._tracesKnown;
+    _weightStorage = other._weightStorage;
+    _optimizer = other._optimizer;
+    _inputs = other._inputs;
+    _outputs = other._outputs;
+    _sortedNodes = other._sortedNodes;
+    _activeConns = other._activeConns;
+    _edges = other._edges;
+    _nodes = other._nodes;
+    if (traces) {
+      _connections = other._connections;
+    } else {
+      _connections.clear();
+      _connections.reserve(other._connections.size());
+      for (const auto &conn : other._connections) {
+        auto &copy = _connections.emplace_back();
+        copy.from = conn.from;
+        copy.to = conn.to;
+        copy.gater = conn.gater;
+        copy.weight = conn.weight;
+        copy.active = conn.active;
+        copy.gain = conn.gain;
+      }
     }
-    for (auto &conn : nptr->connections().inbound) {
-      conns.push_back(conn);
+    _weights = other._weights;
+    _gradients = other._gradients;
+    _xtraces = other._xtraces;
+    if (!traces) {
+      clearGradients();
+      std::fill(_xtraces.values.begin(), _xtraces.values.end(), NeuroFloat(0));
+    }
+    _unusedNodes = other._unusedNodes;
+    _unusedConns = other._unusedConns;
+    _unusedWeights = other._unusedWeights;
+    _crossoverScore = other._crossoverScore;
+    _fitness = other._fitness;
+
+    if (!traces)
+      clear();
+  }
+
+  // recycled slots needsCompact() tolerates regardless of network size
+  constexpr static size_t CompactMinUnused = 1024;
+
+  ActivationPlan &plan() {
+    if (!_plan) {
+      _plan.reset(new ActivationPlan(graph(), _sortedNodes, _inputs,
+                                     _weightStorage));
     }
-    if (nptr->connections().self) {
-      conns.push_back(nptr->connections().self);
+    if (!_planLive) {
+      _plan->pull(graph());
+      _planLive = true;
     }
+    return *_plan;
+  }
 
-    for (auto &conn : conns) {
-      disconnect(*conn);
+  // Frozen networks run f on their plan, others on a temporary one since
+  // training would leave a cached plan stale.
+  template <typename F>
+  auto withPlan(F &&f) -> decltype(f(std::declval<ActivationPlan &>())) {
+    if (_frozen)
+      return f(plan());
+
+    ActivationPlan temp(graph(), _sortedNodes, _inputs, _weightStorage);
+    temp.pull(graph());
+    // transient state goes back to the nodes, even when f throws
+    struct Push {
+      ActivationPlan &plan;
+      Network &net;
+      ~Push() { plan.push(net.graph()); }
+    } push{temp, *this};
+    return f(temp);
+  }
+
+  void checkBatch(size_t stride) const {
+    if (stride < _inputs.size())
+      throw std::runtime_error(
+          "Invalid batch stride, smaller than network input size.");
+  }
+
+  // moves the plan transient state back into the nodes
+  void flushPlan() const {
+    if (_planLive) {
+      // only transient state changes, the graph stays the same
+      _plan->push(const_cast<Network *>(this)->graph());
+      _planLive = false;
+    }
+  }
+
+  void invalidate() {
+    flushPlan();
+    _plan.reset();
+  }
+
+  Graph graph() {
+    return {_nodes, _connections, _weights, _gradients, _xtraces};
+  }
+
+  bool checkPlain() const {
+    if (!_plainPaths)
+      return false;
+
+    std::vector<uint32_t> order(_nodes.size(), NoIndex);
+    for (uint32_t i = 0; i < _sortedNodes.size(); i++) {
+      order[_sortedNodes[i]] = i;
+    }
+    for (auto cidx : _activeConns) {
+      const auto &conn = _connections[cidx];
+      if (conn.gater != NoIndex || conn.from == conn.to)
+        return false;
+      // inputs are all set before anything gets activated
+      if (order[conn.from] >= order[conn.to] &&
+          !getNodePtr(_nodes[conn.from])->isInput())
+        return false;
+    }
+    return true;
+  }
+
+  // pending gradients and optimizer moments, online deltas stay with their
+  // connections and nodes
+  void dropBatch() {
+    Gradients fresh;
+    fresh.connectionDeltas.swap(_gradients.connectionDeltas);
+    fresh.biasDeltas.swap(_gradients.biasDeltas);
+    _gradients = std::move(fresh);
+  }
+
+  // a new slot for node, recycled if possible
+  uint32_t addNode(AnyNode node) {
+    _tracesKnown = false;
+    if (!_unusedNodes.empty()) {
+      auto nidx = uint32_t(_unusedNodes.back());
+      _unusedNodes.pop_back();
+      _nodes[nidx] = std::move(node);
+      if (nidx < _gradients.biasDeltas.size())
+        _gradients.biasDeltas[nidx] = 0;
+      return nidx;
+    }
+    _nodes.emplace_back(std::move(node));
+    return uint32_t(_nodes.size() - 1);
+  }
+
+  // a new weight of value used by conn, recycled if possible
+  uint32_t addWeight(uint32_t conn, NeuroFloat value) {
+    uint32_t widx;
+    if (!_unusedWeights.empty()) {
+      widx = uint32_t(_unusedWeights.back());
+      _unusedWeights.pop_back();
+    } else {
+      widx = uint32_t(_weights.size());
+      _weights.emplace_back();
+    }
+    _weights.mut(widx) = {value, 1};
+    _connections[conn].weight = widx;
+    return widx;
+  }
+
+  void cleanupNode(uint32_t node) {
+    // collect first, disconnecting edits the lists
+    auto conns = getNodePtr(_nodes[node])->connections();
+
+    for (auto conn : conns.gate) {
+      ungate(node, conn);
+    }
+
+    for (auto conn : conns.outbound) {
+      disconnect(conn);
+    }
+    for (auto conn : conns.inbound) {
+      disconnect(conn);
+    }
+    if (conns.self != NoIndex) {
+      disconnect(conns.self);
     }
   }
 
@@ -584,93 +1435,101 @@ protected:
     if (node.index() == 0)
       return ++nit; // don't remove inputs
 
-    const Node *nptr = getNodePtr(node);
-
-    if (nptr->isOutput())
+    if (getNodePtr(node)->isOutput())
       return ++nit; // don't remove outputs
 
-    cleanupNode(node);
+    auto idx = uint32_t(std::distance(_nodes.begin(), nit));
+    cleanupNode(idx);
 
     // need to erase from sorted
-    // this will shift ptrs around
-    auto sit = _sortedNodes.begin();
-    while (sit != _sortedNodes.end()) {
-      auto &inode = sit->get();
-      if (&inode == &node) {
-        _sortedNodes.erase(sit);
-        break;
-      }
-      ++sit;
-    }
+    auto sit = std::find(_sortedNodes.begin(), _sortedNodes.end(), idx);
+    if (sit != _sortedNodes.end())
+      _sortedNodes.erase(sit);
 
-    auto idx = std::distance(_nodes.begin(), nit);
     _unusedNodes.push_back(idx);
 
     return ++nit;
   }
 
-  Connection &connect(AnyNode &from, AnyNode &to) {
-    Connection *conn;
+  // One connection per ordered pair of nodes, see isConnected.
+  uint32_t connect(uint32_t from, uint32_t to) {
+    if (isConnected(from, to))
+      throw std::runtime_error("Attempt to connect two connected nodes!");
+
+    _plainKnown = false;
+    _tracesKnown = false;
+    uint32_t cidx;
 
     if (!_unusedConns.empty()) {
-      auto cidx = _unusedConns.back();
+      cidx = uint32_t(_unusedConns.back());
       _unusedConns.pop_back();
-      conn = &_connections[cidx];
+      if (cidx < _gradients.connectionDeltas.size())
+        _gradients.connectionDeltas[cidx] = 0;
+      if (cidx + 1 < _xtraces.firstSlot.size()) {
+        auto values = _xtraces.values.begin();
+        std::fill(values + _xtraces.firstSlot[cidx],
+                  values + _xtraces.firstSlot[cidx + 1], NeuroFloat(0));
+      }
     } else {
-      conn = &_connections.emplace_back();
+      cidx = uint32_t(_connections.size());
+      _connections.emplace_back();
     }
-    conn->from = getNodePtr(from);
-    conn->to = getNodePtr(to);
-    conn->gater = nullptr;
-
-    if (conn->from->isInput() && conn->to->isInput()) {
+    auto &conn = _connections[cidx];
+    conn.from = from;
+    conn.to = to;
+    conn.gater = NoIndex;
+    conn.weight = NoIndex;
+
+    auto fromNode = getNodePtr(_nodes[from]);
+    auto toNode = getNodePtr(_nodes[to]);
+    if (fromNode->isInput() && toNode->isInput()) {
       throw std::runtime_error("Attempt to connect two input nodes!");
     }
 
-    _activeConns.emplace_back(conn);
+    conn.active = uint32_t(_activeConns.size());
+    _activeConns.emplace_back(cidx);
+    _edges.assign(edgeKey(from, to), cidx);
 
-    if (&from == &to) {
-      std::visit([&](auto &&node) { node.addSelfConnection(*conn); }, to);
+    if (from == to) {
+      toNode->addSelfConnection(cidx);
     } else {
-      std::visit([&](auto &&node) { node.addOutboundConnection(*conn); }, from);
-      std::visit([&](auto &&node) { node.addInboundConnection(*conn); }, to);
+      fromNode->addOutboundConnection(cidx);
+      toNode->addInboundConnection(cidx);
     }
 
-    return *conn;
+    return cidx;
   }
 
-  std::vector<std::reference_wrapper<Connection>> connect(const Group &from,
-                                                          AnyNode &to) {
-    std::vector<std::reference_wrapper<Connection>> conns;
-    for (auto &fromNode : from) {
+  std::vector<uint32_t> connect(const Group &from, uint32_t to) {
+    std::vector<uint32_t> conns;
+    for (auto fromNode : from) {
       conns.emplace_back(connect(fromNode, to));
     }
     return conns;
   }
 
-  std::vector<std::reference_wrapper<Connection>> connect(AnyNode &from,
-                                                          const Group &to) {
-    std::vector<std::reference_wrapper<Connection>> conns;
-    for (auto &toNode : to) {
+  std::vector<uint32_t> connect(uint32_t from, const Group &to) {
+    std::vector<uint32_t> conns;
+    for (auto toNode : to) {
       conns.emplace_back(connect(from, toNode));
     }
     return conns;
   }
 
-  std::vector<std::reference_wrapper<Connection>>
-  connect(const Group &from, const Group &to, ConnectionPattern pattern) {
-    std::vector<std::reference_wrapper<Connection>> conns;
+  std::vector<uint32_t> connect(const Group &from, const Group &to,
+                                ConnectionPattern pattern) {
+    std::vector<uint32_t> conns;
     switch (pattern) {
     case AllToAll: {
-      for (auto &fromNode : from) {
-        for (auto &toNode : to) {
+      for (auto fromNode : from) {
+        for (auto toNode : to) {
           conns.emplace_back(connect(fromNode, toNode));
         }
       }
     } break;
     case AllToElse: {
-      for (auto &fromNode : from) {
-        for (auto &toNode : to) {
+      for (auto fromNode : from) {
+        for (auto toNode : to) {
           if (&from == &to)
             continue;
           conns.emplace_back(connect(fromNode, toNode));
@@ -691,124 +1550,91 @@ protected:
     return conns;
   }
 
-  void releaseWeight(const Weight *weight) {
-    if (weight->second.size() == 0) {
-      auto wit = _weights.begin();
-      while (wit != _weights.end()) {
-        auto &w = *wit;
-        if (weight == &w) {
-          auto widx = std::distance(_weights.begin(), wit);
-          _unusedWeights.push_back(widx);
-          break;
-        } else {
-          ++wit;
-        }
-      }
+  // one user less, recycled once nobody uses it
+  void releaseWeight(uint32_t weight) {
+    assert(_weights[weight].second);
+    if (--_weights.mut(weight).second == 0) {
+      _unusedWeights.push_back(weight);
     }
   }
 
-  template <typename ConnectionsIterator>
-  ConnectionsIterator disconnect(ConnectionsIterator &cit) {
-    Connection &conn = *cit;
+  void disconnect(uint32_t cidx) {
+    _plainKnown = false;
+    _tracesKnown = false;
+    auto &conn = _connections[cidx];
     if (conn.from != conn.to) {
-      conn.from->removeOutboundConnection(conn);
-      conn.to->removeInboundConnection(conn);
+      getNodePtr(_nodes[conn.from])->removeOutboundConnection(cidx);
+      getNodePtr(_nodes[conn.to])->removeInboundConnection(cidx);
     } else {
-      conn.to->removeSelfConnection(conn);
+      getNodePtr(_nodes[conn.to])->removeSelfConnection(cidx);
     }
 
-    if (conn.gater) {
-      conn.gater->removeGate(conn);
+    if (conn.gater != NoIndex) {
+      getNodePtr(_nodes[conn.gater])->removeGate(cidx);
     }
 
-    assert(conn.weight);
-    conn.weight->second.erase(&conn);
+    assert(conn.weight != NoIndex);
     releaseWeight(conn.weight);
 
+    const auto key = edgeKey(conn.from, conn.to);
+    if (_edges.find(key) == cidx)
+      _edges.erase(key);
+
     // Add storage idx to recycle
-    auto idx = std::distance(_connections.begin(), cit);
-    _unusedConns.push_back(idx);
+    _unusedConns.push_back(cidx);
 
     // quick remove from active conns too
-    auto pos =
-        std::find(std::begin(_activeConns), std::end(_activeConns), &conn);
-    if (pos != std::end(_activeConns)) {
-      *pos = _activeConns.back();
-      _activeConns.pop_back();
-    }
-
-    return ++cit;
-  }
-
-  void disconnect(Connection &conn) {
-    auto it = _connections.begin();
-    while (it != _connections.end()) {
-      auto &c = *it;
-      if (&c == &conn) {
-        disconnect(it);
-        return;
-      }
-      ++it;
-    }
+    assert(conn.active != NoIndex);
+    auto last = _activeConns.back();
+    _activeConns[conn.active] = last;
+    _connections[last].active = conn.active;
+    _activeConns.pop_back();
+    conn.active = NoIndex;
   }
 
-  void disconnect(AnyNode &from, AnyNode &to) {
-    auto it = _connections.begin();
-    while (it != _connections.end()) {
-      auto &conn = *it;
-      if (conn.from == getNodePtr(from) && conn.to == getNodePtr(to)) {
-        it = disconnect(it);
-      } else {
-        ++it;
-      }
-    }
+  void disconnect(uint32_t from, uint32_t to) {
+    auto cidx = _edges.find(edgeKey(from, to));
+    if (cidx != NoIndex)
+      disconnect(cidx);
   }
 
-  bool isConnected(const Node *from, const Node *to) {
-    auto it = _connections.begin();
-    while (it != _connections.end()) {
-      auto &conn = *it;
-      if (conn.from == from && conn.to == to) {
-        return true;
-      } else {
-        ++it;
-      }
-    }
-    return false;
+  bool isConnected(uint32_t from, uint32_t to) const {
+    return _edges.find(edgeKey(from, to)) != NoIndex;
   }
 
-  bool isConnected(AnyNode &from, AnyNode &to) {
-    return isConnected(getNodePtr(from), getNodePtr(to));
+  static uint64_t edgeKey(uint32_t from, uint32_t to) {
+    return uint64_t(from) << 32 | to;
   }
 
-  void gate(AnyNode &gater, Connection &conn) {
-    conn.gater = getNodePtr(gater);
-    std::visit([&conn](auto &&node) { node.addGate(conn); }, gater);
+  void gate(uint32_t gater, uint32_t conn) {
+    _plainKnown = false;
+    _tracesKnown = false;
+    _connections[conn].gater = gater;
+    getNodePtr(_nodes[gater])->addGate(conn);
   }
 
-  void ungate(AnyNode &gater, Connection &conn) {
-    conn.gater = nullptr;
-    std::visit([&conn](auto &&node) { node.removeGate(conn); }, gater);
+  void ungate(uint32_t gater, uint32_t conn) {
+    _plainKnown = false;
+    _tracesKnown = false;
+    _connections[conn].gater = NoIndex;
+    getNodePtr(_nodes[gater])->removeGate(conn);
   }
 
-  void
-  gate(AnyNode &gater,
-       const std::vector<std::reference_wrapper<Connection>> &connections) {
-    for (auto &conn : connections) {
+  void gate(uint32_t gater, const std::vector<uint32_t> &connections) {
+    for (auto conn : connections) {
       gate(gater, conn);
     }
   }
 
-  void gate(const Group &group,
-            const std::vector<std::reference_wrapper<Connection>> &connections,
+  void gate(const Group &group, const std::vector<uint32_t> &connections,
             GatingPattern pattern) {
-    VectorSet<const Node *> nodesFrom;
-    VectorSet<const Node *> nodesTo;
-    std::unordered_set<const Connection *> conns;
-    for (auto &conn : connections) {
-      conns.insert(&conn.get());
-      nodesFrom.insert(conn.get().from);
-      nodesTo.insert(conn.get().to);
+    VectorSet<uint32_t> nodesFrom;
+    VectorSet<uint32_t> nodesTo;
+    std::unordered_set<uint32_t> conns;
+    for (auto conn : connections) {
+      conns.insert(conn);
+      nodesFrom.insert(_connections[conn].from);
+      nodesTo.insert(_connections[conn].to);
     }
 
     auto gsize = group.size();
@@ -816,10 +1642,10 @@ protected:
     case GatingPattern::Input: {
       size_t idx = 0;
       for (auto node : nodesTo) {
-        auto &gater = group[idx % gsize];
-        for (auto &conn : node->connections().inbound) {
+        auto gater = group[idx % gsize];
+        for (auto conn : getNodePtr(_nodes[node])->connections().inbound) {
           if (conns.count(conn))
-            gate(gater, *conn);
+            gate(gater, conn);
         }
         idx++;
       }
@@ -827,10 +1653,10 @@ protected:
     case GatingPattern::Output: {
       size_t idx = 0;
       for (auto node : nodesFrom) {
-        auto &gater = group[idx % gsize];
-        for (auto &conn : node->connections().outbound) {
+        auto gater = group[idx % gsize];
+        for (auto conn : getNodePtr(_nodes[node])->connections().outbound) {
           if (conns.count(conn))
-            gate(gater, *conn);
+            gate(gater, conn);
         }
         idx++;
       }
@@ -838,15 +1664,19 @@ protected:
     case GatingPattern::Self: {
       size_t idx = 0;
       for (auto node : nodesFrom) {
-        auto &gater = group[idx % gsize];
-        if (conns.count(node->connections().self))
-          gate(gater, *node->connections().self);
+        auto gater = group[idx % gsize];
+        auto self = getNodePtr(_nodes[node])->connections().self;
+        if (conns.count(self))
+          gate(gater, self);
         idx++;
       }
     } break;
     }
   }
 
+  // random pairs AddFwd/AddBwdConnection try before enumerating all of them
+  constexpr static int MaxConnectionAttempts = 64;
+
   void doMutation(NetworkMutations mutation) {
     switch (mutation) {
     case NetworkMutations::AddNode: {
@@ -857,77 +1687,48 @@ protected:
 
       // Add a node by inserting it in the middle of a connection
       auto ridx = Random::nextUInt() % _activeConns.size();
-      auto &conn = *_activeConns[ridx];
-      auto gater = conn.gater;
+      auto cidx = _activeConns[ridx];
+      const auto from = _connections[cidx].from;
+      const auto to = _connections[cidx].to;
+      const auto gated = _connections[cidx].gater != NoIndex;
 
       // store to node position
       auto pos =
-          std::find_if(std::begin(_sortedNodes), std::end(_sortedNodes),
-                       [&](auto &&n) { return getNodePtr(n) == conn.to; });
-
-      disconnect(conn);
+          std::find(std::begin(_sortedNodes), std::end(_sortedNodes), to);
 
-      // make a new node
-      AnyNode *newNode;
-      if (!_unusedNodes.empty()) {
-        auto nidx = _unusedNodes.back();
-        _unusedNodes.pop_back();
-        newNode = &_nodes[nidx];
-      } else {
-        newNode = &_nodes.emplace_back();
-      }
+      disconnect(cidx);
 
       // init and mutate new node
       auto &anyNode =
-          conn.to->isInput() ? *((AnyNode *)conn.from) : *((AnyNode *)conn.to);
-      *newNode =
+          getNodePtr(_nodes[to])->isInput() ? _nodes[from] : _nodes[to];
+      auto clone =
           std::visit([](auto &&n) { return AnyNode(n.clone()); }, anyNode);
-      std::visit([](auto &&n) { n.mutate(NodeMutations::Squash); }, *newNode);
+      std::visit([](auto &&n) { n.mutate(NodeMutations::Squash); }, clone);
       // the node we cloned might be a output node, turn that flag off
-      std::visit([](auto &&n) { n.setOutput(false); }, *newNode);
+      std::visit([](auto &&n) { n.setOutput(false); }, clone);
+
+      // make a new node
+      auto newNode = addNode(std::move(clone));
 
       // insert into the network
       if (pos != std::end(_sortedNodes)) {
-        _sortedNodes.insert(pos, *newNode);
+        _sortedNodes.insert(pos, newNode);
       }
 
       // connect it
-      auto &anyFrom = *((AnyNode *)conn.from);
-      auto &anyTo = *((AnyNode *)conn.to);
-      auto &c1 = connect(anyFrom, *newNode);
-      auto &c2 = connect(*newNode, anyTo);
-      if (gater) {
+      auto c1 = connect(from, newNode);
+      auto c2 = connect(newNode, to);
+      if (gated) {
         if (Random::nextDouble() < 0.5) {
-          gate(*newNode, c1);
+          gate(newNode, c1);
         } else {
-          gate(*newNode, c2);
+          gate(newNode, c2);
         }
       }
 
       // Add new weights
-      Weight *w1;
-      if (!_unusedWeights.empty()) {
-        auto widx = _unusedWeights.back();
-        _unusedWeights.pop_back();
-        w1 = &_weights[widx];
-      } else {
-        w1 = &_weights.emplace_back();
-      }
-      w1->first = Random::init();
-      w1->second.insert(&c1);
-      c1.weight = w1;
-
-      Weight *w2;
-      if (!_unusedWeights.empty()) {
-        auto widx = _unusedWeights.back();
-        _unusedWeights.pop_back();
-        w2 = &_weights[widx];
-      } else {
-        w2 = &_weights.emplace_back();
-      }
-      w2->first = Random::init();
-      w2->second.insert(&c2);
-      c2.weight = w2;
+      addWeight(c1, Random::init());
+      addWeight(c2, Random::init());
     } break;
     case NetworkMutations::SubNode: {
       auto nin = _inputs.size();
@@ -939,64 +1740,69 @@ protected:
       size_t nidx = 0;
       do {
         nidx = Random::nextUInt() % _sortedNodes.size();
-      } while (_sortedNodes[nidx].get().index() == 0 ||
-               std::visit([](auto &&n) { return n.isOutput(); },
-                          _sortedNodes[nidx].get()));
+      } while (_nodes[_sortedNodes[nidx]].index() == 0 ||
+               getNodePtr(_nodes[_sortedNodes[nidx]])->isOutput());
 
       auto nit = _sortedNodes.begin() + nidx;
       removeNode(nit);
     } break;
     case NetworkMutations::AddFwdConnection:
     case NetworkMutations::AddBwdConnection: {
-      // collect possible forward/backward connections
-      // includes self connections too!
-      std::vector<std::pair<std::reference_wrapper<AnyNode>,
-                            std::reference_wrapper<AnyNode>>>
-          _availConns;
-      if (mutation == NetworkMutations::AddFwdConnection)
-        for (auto fit = _sortedNodes.begin(); fit != _sortedNodes.end();
-             ++fit) {
-          for (auto tit = fit; tit != _sortedNodes.end(); ++tit) {
-            if (!isConnected(*fit, *tit)) {
-              auto fn = getNodePtr(*fit);
-              auto tn = getNodePtr(*tit);
-              if (!fn->isInput() || !tn->isInput())
-                _availConns.emplace_back(*fit, *tit);
-            }
-          }
+      // forward/backward connections, includes self connections too!
+      const auto forward = mutation == NetworkMutations::AddFwdConnection;
+      auto available = [&](uint32_t from, uint32_t to) {
+        return !isConnected(from, to) &&
+               (!getNodePtr(_nodes[from])->isInput() ||
+                !getNodePtr(_nodes[to])->isInput());
+      };
+
+      // draw sorted positions i <= j uniformly until one is free,
+      // b == size stands for the i == j pair drawn a second time
+      const auto nsize = uint32_t(_sortedNodes.size());
+      uint32_t from = NoIndex, to = NoIndex;
+      for (int attempt = 0; nsize && attempt < MaxConnectionAttempts;
+           attempt++) {
+        auto a = Random::nextUInt() % nsize;
+        auto b = Random::nextUInt() % (nsize + 1);
+        auto i = std::min(a, b == nsize ? a : b);
+        auto j = std::max(a, b == nsize ? a : b);
+        auto first = _sortedNodes[forward ? i : j];
+        auto second = _sortedNodes[forward ? j : i];
+        if (available(first, second)) {
+          from = first;
+          to = second;
+          break;
         }
-      else
-        for (auto fit = _sortedNodes.rbegin(); fit != _sortedNodes.rend();
-             ++fit) {
-          for (auto tit = fit; tit != _sortedNodes.rend(); ++tit) {
-            if (!isConnected(*fit, *tit)) {
-              auto fn = getNodePtr(*fit);
-              auto tn = getNodePtr(*tit);
-              if (!fn->isInput() || !tn->isInput())
+      }
+
+      if (from == NoIndex) {
+        // almost complete, collect what's left
+        std::vector<std::pair<uint32_t, uint32_t>> _availConns;
+        auto collect = [&](auto begin, auto end) {
+          for (auto fit = begin; fit != end; ++fit) {
+            for (auto tit = fit; tit != end; ++tit) {
+              if (available(*fit, *tit))
                 _availConns.emplace_back(*fit, *tit);
             }
           }
-        }
-
-      if (_availConns.size() == 0)
-        return;
+        };
+        if (forward)
+          collect(_sortedNodes.begin(), _sortedNodes.end());
+        else
+          collect(_sortedNodes.rbegin(), _sortedNodes.rend());
+
+        if (_availConns.size() == 0)
+          return;
+
+        auto cidx = Random::nextUInt() % _availConns.size();
+        from = _availConns[cidx].first;
+        to = _availConns[cidx].second;
+      }
 
-      auto cidx = Random::nextUInt() % _availConns.size();
-      auto &pair = _availConns[cidx];
-      auto &conn = connect(pair.first.get(), pair.second.get());
+      auto conn = connect(from, to);
 
       // Add new weights
-      Weight *w;
-      if (!_unusedWeights.empty()) {
-        auto widx = _unusedWeights.back();
-        _unusedWeights.pop_back();
-        w = &_weights[widx];
-      } else {
-        w = &_weights.emplace_back();
-      }
-      w->first = Random::init();
-      w->second.insert(&conn);
-      conn.weight = w;
+      addWeight(conn, Random::init());
     } break;
     case NetworkMutations::SubConnection: {
       if (_activeConns.size() == 0) {
@@ -1006,27 +1812,31 @@ protected:
       }
 
       auto ridx = Random::nextUInt() % _activeConns.size();
-      auto &conn = *_activeConns[ridx];
-      disconnect(conn);
+      disconnect(_activeConns[ridx]);
     } break;
     case NetworkMutations::ShareWeight: {
-      if (_activeConns.size() < 2) {
+      const auto csize = _activeConns.size();
+      if (csize < 2) {
         LOG(WARNING) << "ShareWeight mutation on a network with less then 2 "
                         "connections!";
         return;
       }
 
-      auto c1idx = Random::nextUInt() % _activeConns.size();
-      auto c2idx = Random::nextUInt() % _activeConns.size();
-      auto &c1 = *_activeConns[c1idx];
-      auto &c2 = *_activeConns[c2idx];
+      // two different connections
+      auto r1 = Random::nextUInt() % csize;
+      auto r2 = Random::nextUInt() % (csize - 1);
+      if (r2 >= r1)
+        r2++;
+      auto &c1 = _connections[_activeConns[r1]];
+      auto &c2 = _connections[_activeConns[r2]];
 
       auto w1 = c1.weight;
       auto w2 = c2.weight;
+      if (w1 == w2)
+        return;
 
       c1.weight = w2;
-
-      w1->second.erase(&c1);
+      _weights.mut(w2).second++;
       releaseWeight(w1);
     } break;
     case NetworkMutations::SwapNodes: {
@@ -1042,25 +1852,21 @@ protected:
       size_t n1idx = 0;
       do {
         n1idx = Random::nextUInt() % _sortedNodes.size();
-      } while (_sortedNodes[n1idx].get().index() == 0 ||
-               std::visit([](auto &&n) { return n.isOutput(); },
-                          _sortedNodes[n1idx].get()));
+      } while (_nodes[_sortedNodes[n1idx]].index() == 0 ||
+               getNodePtr(_nodes[_sortedNodes[n1idx]])->isOutput());
 
       size_t n2idx = 0;
       do {
         n2idx = Random::nextUInt() % _sortedNodes.size();
-      } while (_sortedNodes[n2idx].get().index() == 0 ||
-               std::visit([](auto &&n) { return n.isOutput(); },
-                          _sortedNodes[n2idx].get()));
+      } while (_nodes[_sortedNodes[n2idx]].index() == 0 ||
+               getNodePtr(_nodes[_sortedNodes[n2idx]])->isOutput());
 
-      auto n1copy = _sortedNodes[n1idx];
-      _sortedNodes[n1idx] = _sortedNodes[n2idx];
-      _sortedNodes[n2idx] = n1copy;
+      std::swap(_sortedNodes[n1idx], _sortedNodes[n2idx]);
     } break;
     case NetworkMutations::AddGate: {
-      std::vector<Connection *> _nonGated;
+      std::vector<uint32_t> _nonGated;
       for (auto conn : _activeConns) {
-        if (!conn->gater)
+        if (_connections[conn].gater == NoIndex)
           _nonGated.emplace_back(conn);
       }
 
@@ -1068,19 +1874,18 @@ protected:
         return;
 
       auto nidx = Random::nextUInt() % _sortedNodes.size();
-      auto &node = _sortedNodes[nidx].get();
+      auto node = _sortedNodes[nidx];
       // ignore input nodes
-      if (node.index() == 0)
+      if (_nodes[node].index() == 0)
         return;
 
       auto ridx = Random::nextUInt() % _nonGated.size();
-      auto &conn = *_nonGated[ridx];
-      gate(node, conn);
+      gate(node, _nonGated[ridx]);
     } break;
     case NetworkMutations::SubGate: {
-      std::vector<Connection *> _gated;
+      std::vector<uint32_t> _gated;
       for (auto conn : _activeConns) {
-        if (conn->gater)
+        if (_connections[conn].gater != NoIndex)
           _gated.emplace_back(conn);
       }
 
@@ -1088,22 +1893,28 @@ protected:
         return;
 
       auto ridx = Random::nextUInt() % _gated.size();
-      auto &conn = *_gated[ridx];
-      ungate(*((AnyNode *)conn.gater), conn);
+      auto conn = _gated[ridx];
+      ungate(_connections[conn].gater, conn);
     } break;
     default:
       break;
     }
   }
 
-  std::vector<std::reference_wrapper<InputNode>> _inputs;
-  std::vector<std::reference_wrapper<AnyNode>> _outputs;
-  std::vector<std::reference_wrapper<AnyNode>> _sortedNodes;
-  std::vector<Connection *> _activeConns;
-
-  std::deque<AnyNode> _nodes;
-  std::deque<Connection> _connections;
-  std::deque<Weight> _weights;
+  // node indices
+  std::vector<uint32_t> _inputs;
+  std::vector<uint32_t> _outputs;
+  std::vector<uint32_t> _sortedNodes;
+  // connection indices
+  std::vector<uint32_t> _activeConns;
+  // active connections by edgeKey
+  EdgeIndex _edges;
+
+  // everything links by index into these
+  std::vector<AnyNode> _nodes;
+  std::vector<Connection> _connections;
+  WeightVector _weights;
+  Gradients _gradients;
 
   // the following are useful when mutationg
   // often we remove nodes/conns/weights
@@ -1133,6 +1944,20 @@ private:
   size_t _crossoverScore = 0;
 
   double _fitness = -std::numeric_limits<float>::max();
+
+  std::unique_ptr<ActivationPlan> _plan;
+  bool _frozen = false;
+  mutable bool _planLive = false;
+  bool _autoCompact = false;
+  // see plain(), checked again after structural changes
+  bool _plain = false;
+  bool _plainKnown = false;
+  bool _plainPaths = true;
+  // see traces(), laid out again after structural changes
+  XTraces _xtraces;
+  bool _tracesKnown = false;
+  WeightStorage _weightStorage = WeightStorage::Float;
+  Optimizer _optimizer = Optimizer::SGD;
 };
 } // namespace Nevolver
 
@@ -9,22 +9,22 @@ public:
   Liquid(int inputs, int hidden_start_max, int outputs) {
     Group inputNodes;
     for (int i = 0; i < inputs; i++) {
-      auto &node = _nodes.emplace_back(InputNode());
+      auto node = addNode(InputNode());
       _sortedNodes.emplace_back(node); // insertion order!
-      _inputs.emplace_back(std::get<InputNode>(node));
+      _inputs.emplace_back(node);
       inputNodes.emplace_back(node);
     }
 
     auto nhidden =
         Random::nextUInt() % std::max(uint32_t(1), uint32_t(hidden_start_max));
     for (uint32_t i = 0; i < nhidden; i++) {
-      auto &node = _nodes.emplace_back(HiddenNode());
+      auto node = addNode(HiddenNode());
       _sortedNodes.emplace_back(node); // insertion order!
     }
 
     Group outputNodes;
     for (int i = 0; i < outputs; i++) {
-      auto &node = _nodes.emplace_back(HiddenNode(true));
+      auto node = addNode(HiddenNode(true));
       _sortedNodes.emplace_back(node); // insertion order!
       _outputs.emplace_back(node);
       outputNodes.emplace_back(node);
@@ -34,11 +34,8 @@ public:
     connect(inputNodes, outputNodes, ConnectionPattern::AllToAll);
 
     // finally setup weights now that we know how many we need
-    for (auto &conn : _connections) {
-      auto &w = _weights.emplace_back();
-      w.first = Random::init();
-      w.second.insert(&conn);
-      conn.weight = &w;
+    for (uint32_t conn = 0; conn < _connections.size(); conn++) {
+      addWeight(conn, Random::init());
     }
 
     constexpr uint32_t max_muts = 100;
@@ -59,7 +56,43 @@ public:
 
     mutate(muts, 0.9, node_muts, 0.9, 0.5);
   }
+
+  // A topology of the given size like long evolutions produce: random
+  // forward connections, some backward and gated ones.
+  // Built directly, growing it through mutate gets quadratic.
+  Liquid(int inputs, int hidden, int outputs, size_t connections) {
+    const auto total = uint32_t(inputs + hidden + outputs);
+    for (uint32_t i = 0; i < total; i++) {
+      auto node = i < uint32_t(inputs)
+                      ? addNode(InputNode())
+                      : addNode(HiddenNode(i >= total - outputs));
+      _sortedNodes.emplace_back(node); // insertion order!
+      if (i < uint32_t(inputs))
+        _inputs.emplace_back(node);
+      else if (i >= total - outputs)
+        _outputs.emplace_back(node);
+    }
+
+    const auto targets = total - inputs;
+    connections = std::min(connections, size_t(targets) * total);
+    while (_activeConns.size() < connections) {
+      auto to = inputs + Random::nextUInt() % targets;
+      auto from = Random::nextDouble() < 0.9
+                      ? Random::nextUInt() % to
+                      : inputs + Random::nextUInt() % targets;
+      if (isConnected(_sortedNodes[from], _sortedNodes[to]))
+        continue;
+
+      auto conn = connect(_sortedNodes[from], _sortedNodes[to]);
+      addWeight(conn, Random::init());
+
+      if (Random::nextDouble() < 0.05)
+        gate(_sortedNodes[inputs + Random::nextUInt() % targets], conn);
+    }
+  }
 };
 } // namespace Nevolver
 
+CEREAL_CLASS_VERSION(Nevolver::Liquid, NEVOLVER_VERSION);
+
 #endif /* PERCEPTRON_H */
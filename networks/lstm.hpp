@@ -10,15 +10,15 @@ public:
   LSTM(int inputs, std::vector<int> hidden, int outputs) {
     Group inputNodes;
     for (int i = 0; i < inputs; i++) {
-      auto &node = _nodes.emplace_back(InputNode());
+      auto node = addNode(InputNode());
       _sortedNodes.emplace_back(node);
-      _inputs.emplace_back(std::get<InputNode>(node));
+      _inputs.emplace_back(node);
       inputNodes.emplace_back(node);
     }
 
     Group outputNodes;
     for (int i = 0; i < outputs; i++) {
-      auto &node = _nodes.emplace_back(HiddenNode(true));
+      auto node = addNode(HiddenNode(true));
       _outputs.emplace_back(node);
       outputNodes.emplace_back(node);
     }
@@ -37,43 +37,43 @@ public:
       auto &outputBlock = i == hsize - 1 ? outputNodes : layers.emplace_back();
 
       for (int i = 0; i < lsize; i++) {
-        auto &node = _nodes.emplace_back(HiddenNode());
+        auto node = addNode(HiddenNode());
         _sortedNodes.emplace_back(node);
         inputGate.emplace_back(node);
-        auto &hidden = std::get<HiddenNode>(node);
+        auto &hidden = std::get<HiddenNode>(_nodes[node]);
         hidden.setBias(1);
       }
 
       for (int i = 0; i < lsize; i++) {
-        auto &node = _nodes.emplace_back(HiddenNode());
+        auto node = addNode(HiddenNode());
         _sortedNodes.emplace_back(node);
         forgetGate.emplace_back(node);
-        auto &hidden = std::get<HiddenNode>(node);
+        auto &hidden = std::get<HiddenNode>(_nodes[node]);
         hidden.setBias(1);
       }
 
       for (int i = 0; i < lsize; i++) {
-        auto &node = _nodes.emplace_back(HiddenNode());
+        auto node = addNode(HiddenNode());
         _sortedNodes.emplace_back(node);
         memoryCell.emplace_back(node);
       }
 
       for (int i = 0; i < lsize; i++) {
-        auto &node = _nodes.emplace_back(HiddenNode());
+        auto node = addNode(HiddenNode());
         _sortedNodes.emplace_back(node);
         outputGate.emplace_back(node);
-        auto &hidden = std::get<HiddenNode>(node);
+        auto &hidden = std::get<HiddenNode>(_nodes[node]);
         hidden.setBias(1);
       }
 
       if (i != hsize - 1) {
         for (int i = 0; i < lsize; i++) {
-          auto &node = _nodes.emplace_back(HiddenNode());
+          auto node = addNode(HiddenNode());
           _sortedNodes.emplace_back(node);
           outputBlock.emplace_back(node);
         }
       } else {
-        for (auto &node : outputNodes) {
+        for (auto node : outputNodes) {
           _sortedNodes.emplace_back(node);
         }
       }
@@ -116,14 +116,13 @@ public:
 #endif
 
     // finally setup weights now that we know how many we need
-    for (auto &conn : _connections) {
-      auto &w = _weights.emplace_back();
-      w.first = Random::init();
-      w.second.insert(&conn);
-      conn.weight = &w;
+    for (uint32_t conn = 0; conn < _connections.size(); conn++) {
+      addWeight(conn, Random::init());
     }
   }
 };
 } // namespace Nevolver
 
+CEREAL_CLASS_VERSION(Nevolver::LSTM, NEVOLVER_VERSION);
+
 #endif /* LSTM_H */
@@ -9,9 +9,9 @@ public:
   MLP(int inputs, const std::vector<int> &hidden, int outputs) {
     Group inputNodes;
     for (int i = 0; i < inputs; i++) {
-      auto &node = _nodes.emplace_back(InputNode());
+      auto node = addNode(InputNode());
       _sortedNodes.emplace_back(node); // insertion order!
-      _inputs.emplace_back(std::get<InputNode>(node));
+      _inputs.emplace_back(node);
       inputNodes.emplace_back(node);
     }
 
@@ -23,7 +23,7 @@ public:
     for (auto lsize : hidden) {
       auto &layer = layers.emplace_back();
       for (int i = 0; i < lsize; i++) {
-        auto &node = _nodes.emplace_back(HiddenNode());
+        auto node = addNode(HiddenNode());
         _sortedNodes.emplace_back(node); // insertion order!
         layer.emplace_back(node);
       }
@@ -34,7 +34,7 @@ public:
 
     Group outputNodes;
     for (int i = 0; i < outputs; i++) {
-      auto &node = _nodes.emplace_back(HiddenNode(true));
+      auto node = addNode(HiddenNode(true));
       _sortedNodes.emplace_back(node); // insertion order!
       _outputs.emplace_back(node);
       outputNodes.emplace_back(node);
@@ -43,14 +43,13 @@ public:
     connect(*previous, outputNodes, ConnectionPattern::AllToAll);
 
     // finally setup weights now that we know how many we need
-    for (auto &conn : _connections) {
-      auto &w = _weights.emplace_back();
-      w.first = Random::init();
-      w.second.insert(&conn);
-      conn.weight = &w;
+    for (uint32_t conn = 0; conn < _connections.size(); conn++) {
+      addWeight(conn, Random::init());
     }
   }
 };
 } // namespace Nevolver
 
+CEREAL_CLASS_VERSION(Nevolver::MLP, NEVOLVER_VERSION);
+
 #endif /* PERCEPTRON_H */
@@ -9,13 +9,13 @@ public:
   NARX(int inputs, const std::vector<int> &hidden, int outputs,
        int input_memory, int output_memory) {
     // keep track of pure ringbuffer memory conns to fix weights
-    std::vector<std::reference_wrapper<Connection>> memoryTunnels;
+    std::vector<uint32_t> memoryTunnels;
 
     Group inputNodes;
     for (int i = 0; i < inputs; i++) {
-      auto &node = _nodes.emplace_back(InputNode());
+      auto node = addNode(InputNode());
       _sortedNodes.emplace_back(node);
-      _inputs.emplace_back(std::get<InputNode>(node));
+      _inputs.emplace_back(node);
       inputNodes.emplace_back(node);
     }
 
@@ -34,7 +34,7 @@ public:
       std::reverse(group.begin(), group.end());
     }
     for (auto &group : outputMemory) {
-      for (auto &node : group) {
+      for (auto node : group) {
         _sortedNodes.emplace_back(node);
       }
     }
@@ -46,7 +46,7 @@ public:
     for (auto lsize : hidden) {
       auto &layer = layers.emplace_back();
       for (int i = 0; i < lsize; i++) {
-        auto &node = _nodes.emplace_back(HiddenNode());
+        auto node = addNode(HiddenNode());
         _sortedNodes.emplace_back(node);
         layer.emplace_back(node);
       }
@@ -70,14 +70,14 @@ public:
       std::reverse(group.begin(), group.end());
     }
     for (auto &group : inputMemory) {
-      for (auto &node : group) {
+      for (auto node : group) {
         _sortedNodes.emplace_back(node);
       }
     }
 
     Group outputNodes;
     for (int i = 0; i < outputs; i++) {
-      auto &node = _nodes.emplace_back(HiddenNode(true));
+      auto node = addNode(HiddenNode(true));
       _outputs.emplace_back(node);
       _sortedNodes.emplace_back(node);
       outputNodes.emplace_back(node);
@@ -104,24 +104,21 @@ public:
     }
 
     // finally setup weights now that we know how many we need
-    for (auto &conn : _connections) {
-      auto &w = _weights.emplace_back();
-      w.first = Random::init();
-      w.second.insert(&conn);
-      conn.weight = &w;
+    for (uint32_t conn = 0; conn < _connections.size(); conn++) {
+      addWeight(conn, Random::init());
     }
 
     // Fix up memory weights
-    for (auto &conn : memoryTunnels) {
-      conn.get().weight->first = 1;
+    for (auto conn : memoryTunnels) {
+      _weights.mut(_connections[conn].weight).first = 1;
     }
   }
 
   Group addMemoryCell(int size) {
     Group res;
     for (int y = 0; y < size; y++) {
-      auto &node = _nodes.emplace_back(HiddenNode(false, true));
-      auto &hiddenNode = std::get<HiddenNode>(node);
+      auto node = addNode(HiddenNode(false, true));
+      auto &hiddenNode = std::get<HiddenNode>(_nodes[node]);
       hiddenNode.setBias(0);
       hiddenNode.setSquash(IdentityS(), IdentityD());
       res.emplace_back(node);
@@ -131,4 +128,6 @@ public:
 };
 } // namespace Nevolver
 
+CEREAL_CLASS_VERSION(Nevolver::NARX, NEVOLVER_VERSION);
+
 #endif /* NARX_H */
@@ -4,13 +4,16 @@
 // #define NEVOLVER_WIDE 4
 
 #include <cassert>
-#include <deque>
+#include <cstring>
 #include <iostream>
 #include <limits>
 #include <map>
+#include <memory>
 #include <ostream>
 #include <random>
+#include <unordered_map>
 #include <unordered_set>
+#include <utility>
 #include <variant>
 #include <vector>
 
@@ -26,6 +29,7 @@
 #include <cereal/types/vector.hpp>
 #include <easylogging++.h>
 
+#include "cow.hpp"
 #include "neurofloat.hpp"
 
 #ifndef M_PI
@@ -36,9 +40,164 @@
 #define M_PIl (3.14159265358979323846264338327950288)
 #endif
 
-#define NEVOLVER_VERSION 0x1
+#define NEVOLVER_VERSION 0x2
+
+// Hot kernels are built for several x86 ISAs, the best one for the running
+// cpu is picked at load time (ifunc). Helpers they use are forced inline
+// so that they get compiled for the same ISA. Vectors wider than the
+// baseline registers can't be cloned (gcc ICEs), such wide builds need a
+// -march baseline instead.
+#if defined(NEVOLVER_DISPATCH) && defined(__x86_64__) && defined(__ELF__) &&   \
+    defined(__has_attribute)
+#if __has_attribute(target_clones) &&                                          \
+    !(defined(NEVOLVER_WIDE) && NEVOLVER_WIDE > 4 && !defined(__AVX__))
+#define NEVOLVER_DISPATCHED                                                    \
+  __attribute__((target_clones("arch=skylake-avx512", "arch=haswell",          \
+                               "arch=sandybridge", "default")))
+#define NEVOLVER_INLINE __attribute__((always_inline))
+#endif
+#endif
+
+#ifndef NEVOLVER_DISPATCHED
+#define NEVOLVER_DISPATCHED
+#define NEVOLVER_INLINE
+#endif
 
 namespace Nevolver {
+/*
+Random floats in bulk, xoshiro128+ over Lanes interleaved streams so that
+generating loops vectorize. Normals come from Box-Muller, with branch free
+log and sincos polynomials (cephes) good to a few float ulps.
+*/
+class BulkRandom final {
+public:
+  constexpr static size_t Lanes = 16;
+
+  BulkRandom() {
+    std::random_device rd;
+    for (auto &state : _s) {
+      for (auto &lane : state) {
+        lane = rd();
+      }
+    }
+    // an all zero stream would stay zero
+    for (auto &lane : _s[0]) {
+      lane |= 1;
+    }
+  }
+
+  // n uniforms in [0, 1)
+  NEVOLVER_DISPATCHED void uniforms(float *out, size_t n) {
+    uint32_t bits[Lanes];
+    for (size_t i = 0; i < n; i += Lanes) {
+      next(bits);
+      const auto count = std::min(Lanes, n - i);
+      for (size_t l = 0; l < count; l++) {
+        out[i + l] = toUnit(bits[l]);
+      }
+    }
+  }
+
+  // n normals of deviation sigma
+  NEVOLVER_DISPATCHED void normals(float *out, size_t n, float sigma) {
+    uint32_t radii[Lanes];
+    uint32_t turns[Lanes];
+    float block[Lanes * 2];
+    for (size_t i = 0; i < n; i += Lanes * 2) {
+      next(radii);
+      next(turns);
+      for (size_t l = 0; l < Lanes; l++) {
+        // 1 - u keeps log away from 0
+        const auto radius =
+            sigma * std::sqrt(-2.0f * logUnit(1.0f - toUnit(radii[l])));
+        float sine, cosine;
+        sinCosTurn(toUnit(turns[l]), sine, cosine);
+        block[l] = radius * cosine;
+        block[l + Lanes] = radius * sine;
+      }
+      const auto count = std::min(Lanes * 2, n - i);
+      std::memcpy(out + i, block, count * sizeof(float));
+    }
+  }
+
+private:
+  NEVOLVER_INLINE void next(uint32_t *out) {
+    for (size_t l = 0; l < Lanes; l++) {
+      out[l] = _s[0][l] + _s[3][l];
+      const auto t = _s[1][l] << 9;
+      _s[2][l] ^= _s[0][l];
+      _s[3][l] ^= _s[1][l];
+      _s[1][l] ^= _s[2][l];
+      _s[0][l] ^= _s[3][l];
+      _s[2][l] ^= t;
+      _s[3][l] = (_s[3][l] << 11) | (_s[3][l] >> 21);
+    }
+  }
+
+  // top 24 bits, the low ones of xoshiro+ are weak
+  NEVOLVER_INLINE static float toUnit(uint32_t bits) {
+    return float(int32_t(bits >> 8)) * (1.0f / 16777216.0f);
+  }
+
+  // x in [2^-24, 1]
+  NEVOLVER_INLINE static float logUnit(float x) {
+    uint32_t bits;
+    std::memcpy(&bits, &x, sizeof(float));
+    auto e = float(int32_t(bits >> 23) - 127);
+    bits = (bits & 0x7FFFFFu) | 0x3F800000u;
+    float m;
+    std::memcpy(&m, &bits, sizeof(float));
+
+    // mantissa in [sqrt(1/2), sqrt(2))
+    const auto big = m > 1.41421356f;
+    m = big ? m * 0.5f : m;
+    e = big ? e + 1.0f : e;
+
+    const auto f = m - 1.0f;
+    const auto z = f * f;
+    auto y = 7.0376836292E-2f;
+    y = y * f - 1.1514610310E-1f;
+    y = y * f + 1.1676998740E-1f;
+    y = y * f - 1.2420140846E-1f;
+    y = y * f + 1.4249322787E-1f;
+    y = y * f - 1.6668057665E-1f;
+    y = y * f + 2.0000714765E-1f;
+    y = y * f - 2.4999993993E-1f;
+    y = y * f + 3.3333331174E-1f;
+    y = y * f * z;
+    y += -2.12194440E-4f * e;
+    y += -0.5f * z;
+    return f + y + 0.693359375f * e;
+  }
+
+  // sine and cosine of t full turns, t in [0, 1)
+  NEVOLVER_INLINE static void sinCosTurn(float t, float &sine,
+                                         float &cosine) {
+    // nearest quarter turn and what is left, within pi / 4
+    const auto q = t * 4.0f;
+    const auto j = int32_t(q + 0.5f);
+    const auto r = (q - float(j)) * 1.57079632679f;
+    const auto z = r * r;
+
+    auto s = -1.9515295891E-4f;
+    s = s * z + 8.3321608736E-3f;
+    s = s * z - 1.6666654611E-1f;
+    s = r + r * z * s;
+    auto c = 2.443315711809948E-5f;
+    c = c * z - 1.388731625493765E-3f;
+    c = c * z + 4.166664568298827E-2f;
+    c = 1.0f - 0.5f * z + z * z * c;
+
+    const auto odd = (j & 1) != 0;
+    const auto rs = odd ? c : s;
+    const auto rc = odd ? s : c;
+    sine = (j & 2) ? -rs : rs;
+    cosine = ((j + 1) & 2) ? -rc : rc;
+  }
+
+  uint32_t _s[4][Lanes];
+};
+
 class Random {
 public:
   static double nextDouble() { return _udis(_gen); }
@@ -57,6 +216,21 @@ public:
 
   static uint32_t nextUInt() { return _uintdis(_gen); }
 
+  // Trials to skip before the next one hitting at rate, same odds as
+  // checking nextDouble() < rate on every trial but a single draw.
+  static size_t skip(double rate) {
+    constexpr auto never = std::numeric_limits<size_t>::max();
+    if (rate >= 1.0)
+      return 0;
+    if (rate <= 0.0)
+      return never;
+
+    // geometric, 1 - u keeps log away from 0
+    const auto gap = std::floor(std::log(1.0 - nextDouble()) /
+                                std::log1p(-rate));
+    return gap < double(never) ? size_t(gap) : never;
+  }
+
   // our weight/bias init
   static NeuroFloat init() { return next() * 0.2 - 0.1; }
 
@@ -73,22 +247,38 @@ public:
 #endif
   }
 
+  // many uniforms or adjust() lanes at once
+  static void uniforms(float *out, size_t n) { _bulk.uniforms(out, n); }
+
+  static void adjustments(float *out, size_t n) {
+    _bulk.normals(out, n, float(AdjustDeviation));
+  }
+
+  constexpr static double AdjustDeviation = 0.1;
+
 private:
+  static inline thread_local BulkRandom _bulk{};
   static inline thread_local std::random_device _rd{};
   static inline thread_local std::mt19937 _gen{_rd()};
   static inline thread_local std::uniform_int_distribution<> _uintdis{};
   static inline thread_local std::uniform_real_distribution<> _udis{0.0, 1.0};
-  static inline thread_local std::normal_distribution<> _ndis{0.0, 0.1};
+  static inline thread_local std::normal_distribution<> _ndis{
+      0.0, AdjustDeviation};
 };
 
 class Node;
 class InputNode;
 class HiddenNode;
+class ActivationPlan;
 struct Connection;
 
 using AnyNode = std::variant<InputNode, HiddenNode>;
-using Group = std::vector<std::reference_wrapper<AnyNode>>;
-using Weight = std::pair<NeuroFloat, std::unordered_set<const Connection *>>;
+// node indices
+using Group = std::vector<uint32_t>;
+// value and how many connections use it
+using Weight = std::pair<NeuroFloat, uint32_t>;
+// copies of a network share weight pages until they write them
+using WeightVector = CowVector<Weight>;
 } // namespace Nevolver
 
 // Foundation
@@ -99,4 +289,14 @@ using Weight = std::pair<NeuroFloat, std::unordered_set<const Connection *>>;
 #include "node.hpp"
 #include "nodes/annhidden.hpp"
 
+namespace Nevolver {
+inline const Node &Graph::node(uint32_t idx) const {
+  // both alternatives are nodes, no need for a visit
+  auto &node = nodes[idx];
+  if (auto hidden = std::get_if<HiddenNode>(&node))
+    return *hidden;
+  return *std::get_if<InputNode>(&node);
+}
+} // namespace Nevolver
+
 #endif /* NEVOLVER_H */
@@ -15,47 +15,55 @@ public:
 
   NeuroFloat responsibility() const { return _responsibility; }
 
-  void addInboundConnection(Connection &conn) const {
-    _connections.inbound.push_back(&conn);
+  void addInboundConnection(uint32_t conn) const {
+    _connections.inbound.push_back(conn);
   }
 
-  void removeInboundConnection(Connection &conn) const {
-    _connections.inbound.erase(
-        std::remove_if(_connections.inbound.begin(), _connections.inbound.end(),
-                       [&](auto &&c) { return c == &conn; }),
-        _connections.inbound.end());
+  void removeInboundConnection(uint32_t conn) const {
+    _connections.inbound.erase(std::remove(_connections.inbound.begin(),
+                                           _connections.inbound.end(), conn),
+                               _connections.inbound.end());
   }
 
-  void addOutboundConnection(Connection &conn) const {
-    _connections.outbound.push_back(&conn);
+  void addOutboundConnection(uint32_t conn) const {
+    _connections.outbound.push_back(conn);
   }
 
-  void removeOutboundConnection(Connection &conn) const {
-    _connections.outbound.erase(
-        std::remove_if(_connections.outbound.begin(),
-                       _connections.outbound.end(),
-                       [&](auto &&c) { return c == &conn; }),
-        _connections.outbound.end());
+  void removeOutboundConnection(uint32_t conn) const {
+    _connections.outbound.erase(std::remove(_connections.outbound.begin(),
+                                            _connections.outbound.end(), conn),
+                                _connections.outbound.end());
   }
 
-  void addSelfConnection(Connection &conn) const {
-    if (_connections.self) {
+  void addSelfConnection(uint32_t conn) const {
+    if (_connections.self != NoIndex) {
       throw std::runtime_error("Node already has a self connection.");
     }
-    _connections.self = &conn;
+    _connections.self = conn;
   }
 
-  void removeSelfConnection(Connection &_conn) const {
-    _connections.self = nullptr;
+  void removeSelfConnection(uint32_t _conn) const {
+    _connections.self = NoIndex;
   }
 
-  void addGate(Connection &conn) const { _connections.gate.push_back(&conn); }
+  void addGate(uint32_t conn) const { _connections.gate.push_back(conn); }
 
-  void removeGate(Connection &conn) const {
-    _connections.gate.erase(
-        std::remove_if(_connections.gate.begin(), _connections.gate.end(),
-                       [&](auto &&c) { return c == &conn; }),
-        _connections.gate.end());
+  void removeGate(uint32_t conn) const {
+    _connections.gate.erase(std::remove(_connections.gate.begin(),
+                                        _connections.gate.end(), conn),
+                            _connections.gate.end());
+  }
+
+  // connections got renumbered, old index to new one
+  void remapConnections(const std::vector<uint32_t> &map) const {
+    for (auto &conn : _connections.inbound)
+      conn = map[conn];
+    for (auto &conn : _connections.outbound)
+      conn = map[conn];
+    for (auto &conn : _connections.gate)
+      conn = map[conn];
+    if (_connections.self != NoIndex)
+      _connections.self = map[_connections.self];
   }
 
   bool isOutput() const { return _kind == NodeKind::Output; }
@@ -74,26 +82,45 @@ protected:
 
 template <typename T> class NodeCommon : public Node {
 public:
-  NeuroFloat activate() { return as_underlying().doActivate(); }
+  // index is the one of this node in graph
+  NeuroFloat activate(const Graph &graph, uint32_t index) {
+    return as_underlying().doActivate(graph, index);
+  }
 
-  NeuroFloat activateFast() { return as_underlying().doFastActivate(); }
+  NeuroFloat activateFast(const Graph &graph) {
+    return as_underlying().doFastActivate(graph);
+  }
 
-  void propagate(double rate, double momentum, bool update,
-                 NeuroFloat target = 0) {
-    return as_underlying().doPropagate(rate, momentum, update, target);
+  // for networks without gates, self or backward connections, see
+  // Network::plain()
+  NeuroFloat activatePlain(const Graph &graph) {
+    return as_underlying().doPlainActivate(graph);
   }
 
-  void clear() { as_underlying().doClear(); }
+  void propagate(const Graph &graph, uint32_t index, double rate,
+                 double momentum, bool update, const NeuroFloat &target = 0) {
+    return as_underlying().doPropagate(graph, index, rate, momentum, update,
+                                       target);
+  }
+
+  void propagatePlain(const Graph &graph, uint32_t index, double rate,
+                      double momentum, bool update,
+                      const NeuroFloat &target = 0) {
+    return as_underlying().doPlainPropagate(graph, index, rate, momentum,
+                                            update, target);
+  }
+
+  void clear(const Graph &graph) { as_underlying().doClear(graph); }
 
   void mutate(NodeMutations mutation) { as_underlying().doMutate(mutation); }
 
-  T clone() {
+  T clone() const {
     // clone this but without any connection and such
     T res = as_underlying();
     res._connections.inbound.clear();
     res._connections.outbound.clear();
     res._connections.gate.clear();
-    res._connections.self = nullptr;
+    res._connections.self = NoIndex;
     return res;
   }
 
@@ -113,14 +140,22 @@ public:
 
   void setInput(NeuroFloat input) { _activation = input; }
 
-  NeuroFloat doActivate() { return _activation; }
+  NeuroFloat doActivate(const Graph &graph, uint32_t index) {
+    return _activation;
+  }
+
+  NeuroFloat doFastActivate(const Graph &graph) { return _activation; }
+
+  NeuroFloat doPlainActivate(const Graph &graph) { return _activation; }
 
-  NeuroFloat doFastActivate() { return _activation; }
+  void doPropagate(const Graph &graph, uint32_t index, double rate,
+                   double momentum, bool update, const NeuroFloat &target) {}
 
-  void doPropagate(double rate, double momentum, bool update,
-                   NeuroFloat target) {}
+  void doPlainPropagate(const Graph &graph, uint32_t index, double rate,
+                        double momentum, bool update,
+                        const NeuroFloat &target) {}
 
-  void doClear() {}
+  void doClear(const Graph &graph) {}
 
   void doMutate(NodeMutations mutation) {
     // Input has none
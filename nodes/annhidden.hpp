@@ -11,77 +11,66 @@ public:
     _kind = is_output ? NodeKind::Output : NodeKind::Normal;
   }
 
-  NeuroFloat doActivate() {
+  NEVOLVER_DISPATCHED NeuroFloat doActivate(const Graph &graph,
+                                            uint32_t index) {
+    auto &conns = graph.connections;
     _old = _state;
 
-    if (_connections.self) {
-      _state =
-          _connections.self->gain * _connections.self->w() * _state + _bias;
+    if (_connections.self != NoIndex) {
+      auto &self = conns[_connections.self];
+      _state = self.gain * graph.w(self) * _state + _bias;
     } else {
       _state = _bias;
     }
 
-    for (auto connection : _connections.inbound) {
-      _state +=
-          connection->from->current() * connection->w() * connection->gain;
+    for (auto c : _connections.inbound) {
+      auto &connection = conns[c];
+      _state += graph.node(connection.from).current() * graph.w(connection) *
+                connection.gain;
     }
 
-    auto fwd = std::visit([&](auto &&f) { return f(_state); }, _squash);
+    auto fwd = Squash::activate(_op, _state, _derivative);
     _activation = fwd * _mask;
-    _derivative = std::visit([&](auto &&f) { return f(_state, fwd); }, _derive);
-
-    _tmpNodes.clear();
-    _tmpInfluence.clear();
-    for (auto connection : _connections.gate) {
-      auto node = connection->to;
-      auto pos = std::find(std::begin(_tmpNodes), std::end(_tmpNodes), node);
-      if (pos != std::end(_tmpNodes)) {
-        auto idx = std::distance(std::begin(_tmpNodes), pos);
-        _tmpInfluence[idx] += connection->w() * connection->from->current();
-      } else {
-        _tmpNodes.emplace_back(node);
-        auto plus =
-            node->connections().self && node->connections().self->gater == this
-                ? static_cast<const HiddenNode *>(node)->_old
-                : 0;
-        _tmpInfluence.emplace_back(
-            connection->w() * connection->from->current() + plus);
-      }
-      connection->gain = _activation;
+
+    // influences on the nodes gated, their decay after gating
+    auto &traces = graph.traces;
+    const auto firstTarget = traces.firstTarget[index];
+    const auto lastTarget = traces.firstTarget[index + 1];
+    for (auto t = firstTarget; t < lastTarget; t++) {
+      traces.influence[t] = selfGated(graph, traces.targets[t], index);
+    }
+    for (auto c : _connections.gate) {
+      auto &connection = conns[c];
+      traces.influence[traces.targetOf[c]] +=
+          graph.w(connection) * graph.node(connection.from).current();
+      connection.gain = _activation;
+    }
+    for (auto t = firstTarget; t < lastTarget; t++) {
+      auto self = traces.selfs[t];
+      if (self != NoIndex)
+        traces.decay[t] = conns[self].gain * graph.w(conns[self]);
     }
 
-    for (auto connection : _connections.inbound) {
-      if (_connections.self) {
-        connection->eligibility =
-            _connections.self->gain * _connections.self->w() *
-                connection->eligibility +
-            connection->from->current() * connection->gain;
+    for (auto c : _connections.inbound) {
+      auto &connection = conns[c];
+      auto &from = graph.node(connection.from);
+      if (_connections.self != NoIndex) {
+        auto &self = conns[_connections.self];
+        connection.eligibility =
+            self.gain * graph.w(self) * connection.eligibility +
+            from.current() * connection.gain;
       } else {
-        connection->eligibility =
-            connection->from->current() * connection->gain;
+        connection.eligibility = from.current() * connection.gain;
       }
 
-      auto size = _tmpNodes.size();
-      for (size_t i = 0; i < size; i++) {
-        auto node = _tmpNodes[i];
-        auto influence = _tmpInfluence[i];
-        auto pos = std::find(std::begin(connection->xtraces.nodes),
-                             std::end(connection->xtraces.nodes), node);
-        if (pos != std::end(connection->xtraces.nodes)) {
-          auto idx = std::distance(std::begin(connection->xtraces.nodes), pos);
-          if (node->connections().self) {
-            connection->xtraces.values[idx] =
-                node->connections().self->gain * node->connections().self->w() *
-                    connection->xtraces.values[idx] +
-                _derivative * connection->eligibility * influence;
-          } else {
-            connection->xtraces.values[idx] =
-                _derivative * connection->eligibility * influence;
-          }
+      auto slot = traces.firstSlot[c];
+      for (auto t = firstTarget; t < lastTarget; t++, slot++) {
+        auto &value = traces.values[slot];
+        if (traces.selfs[t] != NoIndex) {
+          value = traces.decay[t] * value +
+                  _derivative * connection.eligibility * traces.influence[t];
         } else {
-          connection->xtraces.nodes.emplace_back(node);
-          connection->xtraces.values.emplace_back(
-              _derivative * connection->eligibility * influence);
+          value = _derivative * connection.eligibility * traces.influence[t];
         }
       }
     }
@@ -89,33 +78,55 @@ public:
     return _activation;
   }
 
-  NeuroFloat doFastActivate() {
+  NEVOLVER_DISPATCHED NeuroFloat doFastActivate(const Graph &graph) {
+    auto &conns = graph.connections;
     _old = _state;
 
-    if (_connections.self) {
-      _state =
-          _connections.self->gain * _connections.self->w() * _state + _bias;
+    if (_connections.self != NoIndex) {
+      auto &self = conns[_connections.self];
+      _state = self.gain * graph.w(self) * _state + _bias;
     } else {
       _state = _bias;
     }
 
-    for (auto connection : _connections.inbound) {
-      _state +=
-          connection->from->current() * connection->w() * connection->gain;
+    for (auto c : _connections.inbound) {
+      auto &connection = conns[c];
+      _state += graph.node(connection.from).current() * graph.w(connection) *
+                connection.gain;
     }
 
-    auto fwd = std::visit([&](auto &&f) { return f(_state); }, _squash);
+    auto fwd = Squash::activate(_op, _state);
     _activation = fwd * _mask;
 
-    for (auto connection : _connections.gate) {
-      connection->gain = _activation;
+    for (auto c : _connections.gate) {
+      conns[c].gain = _activation;
+    }
+
+    return _activation;
+  }
+
+  // doActivate without self connections and gates, eligibilities are just
+  // the inputs and come from the same pass
+  NEVOLVER_DISPATCHED NeuroFloat doPlainActivate(const Graph &graph) {
+    auto &conns = graph.connections;
+    _old = _state;
+    _state = _bias;
+    for (auto c : _connections.inbound) {
+      auto &connection = conns[c];
+      auto current = graph.node(connection.from).current();
+      _state += current * graph.w(connection) * connection.gain;
+      connection.eligibility = current * connection.gain;
     }
 
+    auto fwd = Squash::activate(_op, _state, _derivative);
+    _activation = fwd * _mask;
     return _activation;
   }
 
-  void doPropagate(double rate, double momentum, bool update,
-                   NeuroFloat target) {
+  NEVOLVER_DISPATCHED void doPropagate(const Graph &graph, uint32_t index,
+                                       double rate, double momentum,
+                                       bool update, const NeuroFloat &target) {
+    auto &conns = graph.connections;
     NeuroFloat wrate = rate;
     NeuroFloat wmomentum = momentum;
 
@@ -125,22 +136,21 @@ public:
     } else {
       NeuroFloat error = 0;
 
-      for (auto connection : _connections.outbound) {
-        error += connection->to->responsibility() * connection->w() *
-                 connection->gain;
+      for (auto c : _connections.outbound) {
+        auto &connection = conns[c];
+        error += graph.node(connection.to).responsibility() *
+                 graph.w(connection) * connection.gain;
       }
       _projected = _derivative * error;
 
       error = 0;
 
-      for (auto connection : _connections.gate) {
-        auto node = connection->to;
-        NeuroFloat influence =
-            node->connections().self && node->connections().self->gater == this
-                ? static_cast<const HiddenNode *>(node)->_old
-                : 0;
-        influence += connection->w() * connection->from->current();
-        error += connection->to->responsibility() * influence;
+      for (auto c : _connections.gate) {
+        auto &connection = conns[c];
+        NeuroFloat influence = selfGated(graph, connection.to, index);
+        influence +=
+            graph.w(connection) * graph.node(connection.from).current();
+        error += graph.node(connection.to).responsibility() * influence;
       }
 
       _gated = _derivative * error;
@@ -150,47 +160,80 @@ public:
     if (_is_constant)
       return;
 
-    for (auto connection : _connections.inbound) {
-      auto gradient = _projected * connection->eligibility;
+    for (auto c : _connections.inbound) {
+      auto &connection = conns[c];
+      auto gradient = _projected * connection.eligibility;
 
       // Gated nets only
-      size_t size = connection->xtraces.nodes.size();
-      for (size_t i = 0; i < size; i++) {
-        auto node = connection->xtraces.nodes[i];
-        auto value = connection->xtraces.values[i];
-
-        gradient += node->responsibility() * value;
+      auto &traces = graph.traces;
+      for (auto slot = traces.firstSlot[c]; slot < traces.firstSlot[c + 1];
+           slot++) {
+        gradient += graph.node(traces.nodes[slot]).responsibility() *
+                    traces.values[slot];
       }
 
-      auto deltaWeight = wrate * gradient * _mask;
-      if (update) {
-        deltaWeight += wmomentum * connection->previousDeltaWeight;
-        connection->weight->first += deltaWeight;
-        connection->previousDeltaWeight = deltaWeight;
+      learnWeight(graph, c, gradient, wrate, wmomentum, update);
+    }
+
+    learnBias(graph, index, wrate, wmomentum, update);
+  }
+
+  // Plain backprop, no traces nor gates to care about. Same results as
+  // doPropagate on such networks.
+  NEVOLVER_DISPATCHED void doPlainPropagate(const Graph &graph,
+                                            uint32_t index, double rate,
+                                            double momentum, bool update,
+                                            const NeuroFloat &target) {
+    auto &conns = graph.connections;
+    NeuroFloat wrate = rate;
+    NeuroFloat wmomentum = momentum;
+
+    if (_kind == NodeKind::Output) {
+      _responsibility = target - _activation;
+      _projected = _responsibility;
+    } else {
+      NeuroFloat error = 0;
+      for (auto c : _connections.outbound) {
+        auto &connection = conns[c];
+        error += graph.node(connection.to).responsibility() *
+                 graph.w(connection) * connection.gain;
       }
+      _projected = _derivative * error;
+      _gated = 0;
+      _responsibility = _projected + _gated;
+    }
+
+    if (_is_constant)
+      return;
+
+    for (auto c : _connections.inbound) {
+      learnWeight(graph, c, _projected * conns[c].eligibility, wrate,
+                  wmomentum, update);
     }
 
-    auto deltaBias = wrate * _responsibility;
-    deltaBias += wmomentum * _previousDeltaBias;
-    _bias += deltaBias;
-    _previousDeltaBias = deltaBias;
+    learnBias(graph, index, wrate, wmomentum, update);
   }
 
   void setSquash(SquashFunc squash, DeriveFunc derive) {
-    _squash = squash;
-    _derive = derive;
+    assert(squash.index() == derive.index());
+    _op = SquashOp(squash.index());
   }
 
+  void setSquash(SquashOp op) { _op = op; }
+
+  SquashOp squash() const { return _op; }
+
   void setBias(NeuroFloat bias) { _bias = bias; }
 
-  void doClear() {
-    for (auto &conn : _connections.inbound) {
-      conn->eligibility = 0;
-      conn->xtraces.nodes.clear();
-      conn->xtraces.values.clear();
+  NeuroFloat bias() const { return _bias; }
+
+  void doClear(const Graph &graph) {
+    for (auto c : _connections.inbound) {
+      auto &conn = graph.connections[c];
+      conn.eligibility = 0;
     }
-    for (auto &conn : _connections.gate) {
-      conn->gain = 0;
+    for (auto c : _connections.gate) {
+      graph.connections[c].gain = 0;
     }
     _responsibility = 0;
     _projected = 0;
@@ -203,9 +246,7 @@ public:
   void doMutate(NodeMutations mutation) {
     switch (mutation) {
     case NodeMutations::Squash: {
-      auto funcs = Squash::random();
-      _squash = funcs.first;
-      _derive = funcs.second;
+      _op = Squash::randomOp();
     } break;
     case NodeMutations::Bias: {
       _bias += Random::adjust();
@@ -215,23 +256,70 @@ public:
     }
   }
 
+  // squashes are still stored as variants, existing models stay readable
   template <class Archive>
-  void serialize(Archive &ar, std::uint32_t const version) {
-    ar(_squash, _derive, _bias, _mask, _kind, _is_constant);
+  void save(Archive &ar, std::uint32_t const version) const {
+    auto idx = size_t(_op);
+    ar(Squash::SFuncs[idx], Squash::DFuncs[idx], _bias, _mask, _kind,
+       _is_constant);
+  }
+
+  template <class Archive> void load(Archive &ar, std::uint32_t const version) {
+    SquashFunc squash;
+    DeriveFunc derive;
+    ar(squash, derive, _bias, _mask, _kind, _is_constant);
+    _op = SquashOp(squash.index());
   }
 
 private:
-  SquashFunc _squash{SigmoidS()};
-  DeriveFunc _derive{SigmoidD()};
+  friend class ActivationPlan;
+
+  NEVOLVER_INLINE void learnWeight(const Graph &graph, uint32_t c,
+                                   const NeuroFloat &gradient,
+                                   const NeuroFloat &rate,
+                                   const NeuroFloat &momentum, bool update) {
+    auto &connection = graph.connections[c];
+    if (update) {
+      auto &previous = graph.gradients.connectionDeltas[c];
+      auto deltaWeight = rate * gradient * _mask;
+      deltaWeight += momentum * previous;
+      graph.weights.mut(connection.weight).first += deltaWeight;
+      previous = deltaWeight;
+    } else {
+      graph.gradients.weights[connection.weight] += gradient * _mask;
+    }
+  }
+
+  NEVOLVER_INLINE void learnBias(const Graph &graph, uint32_t index,
+                                 const NeuroFloat &rate,
+                                 const NeuroFloat &momentum, bool update) {
+    if (update) {
+      auto &previous = graph.gradients.biasDeltas[index];
+      auto deltaBias = rate * _responsibility;
+      deltaBias += momentum * previous;
+      _bias += deltaBias;
+      previous = deltaBias;
+    } else {
+      graph.gradients.biases[index] += _responsibility;
+    }
+  }
+
+  // the old state of node if this (index) gates its self connection
+  NEVOLVER_INLINE static NeuroFloat selfGated(const Graph &graph, uint32_t node,
+                                              uint32_t index) {
+    auto self = graph.node(node).connections().self;
+    if (self != NoIndex && graph.connections[self].gater == index)
+      return static_cast<const HiddenNode &>(graph.node(node))._old;
+    return 0;
+  }
+
+  SquashOp _op{SquashOp::Sigmoid};
   NeuroFloat _bias{Random::init()};
   NeuroFloat _state{0};
   NeuroFloat _old{0};
   NeuroFloat _mask{1};
   NeuroFloat _derivative{0};
-  NeuroFloat _previousDeltaBias{0};
   bool _is_constant;
-  std::vector<const Node *> _tmpNodes;
-  std::vector<NeuroFloat> _tmpInfluence;
   NeuroFloat _projected{0};
   NeuroFloat _gated{0};
 };
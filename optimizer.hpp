@@ -0,0 +1,108 @@
+#ifndef OPTIMIZER_H
+#define OPTIMIZER_H
+
+#include "nevolver.hpp"
+
+namespace Nevolver {
+enum class Optimizer { SGD, Nesterov, RMSProp, Adam };
+
+/*
+One mini-batch update over parameters laid out as parallel arrays, the
+summed gradients, their first moments (the last steps for SGD and Nesterov)
+and their second moments.
+
+momentum is the heavy ball one of SGD and RMSProp, the look ahead one of
+Nesterov and beta1 of Adam. Second moments decay by RMSPropDecay or
+AdamDecay.
+*/
+class OptimizerStep final {
+public:
+  constexpr static double RMSPropDecay = 0.9;
+  constexpr static double AdamDecay = 0.999;
+  constexpr static double Epsilon = 1e-8;
+
+  // samples summed in the gradients, update counts from 1
+  OptimizerStep(Optimizer kind, double rate, double momentum, size_t samples,
+                size_t update)
+      : _kind(kind), _rate(rate), _momentum(momentum),
+        _scale(1.0 / double(samples)) {
+    if (_kind == Optimizer::Adam) {
+      _correction1 = 1.0 / (1.0 - std::pow(momentum, double(update)));
+      _correction2 = 1.0 / (1.0 - std::pow(AdamDecay, double(update)));
+    }
+  }
+
+  bool usesSquares() const {
+    return _kind == Optimizer::RMSProp || _kind == Optimizer::Adam;
+  }
+
+  // sums become the deltas to add to their parameters
+  NEVOLVER_DISPATCHED void run(NeuroFloat *sums, NeuroFloat *steps,
+                               NeuroFloat *squares, size_t n) const {
+    const NeuroFloat momentum = _momentum;
+    const NeuroFloat epsilon = Epsilon;
+    switch (_kind) {
+    case Optimizer::SGD: {
+      const NeuroFloat scale = _rate * _scale;
+      for (size_t i = 0; i < n; i++) {
+        auto step = scale * sums[i] + momentum * steps[i];
+        steps[i] = step;
+        sums[i] = step;
+      }
+    } break;
+    case Optimizer::Nesterov: {
+      const NeuroFloat scale = _rate * _scale;
+      for (size_t i = 0; i < n; i++) {
+        auto g = scale * sums[i];
+        auto velocity = momentum * steps[i] + g;
+        steps[i] = velocity;
+        sums[i] = momentum * velocity + g;
+      }
+    } break;
+    case Optimizer::RMSProp: {
+      const NeuroFloat scale = _scale;
+      const NeuroFloat rate = _rate;
+      const NeuroFloat decay = RMSPropDecay;
+      const NeuroFloat rest = 1.0 - RMSPropDecay;
+      for (size_t i = 0; i < n; i++) {
+        auto g = scale * sums[i];
+        auto square = decay * squares[i] + rest * g * g;
+        auto step = rate * g / (std::sqrt(square) + epsilon) +
+                    momentum * steps[i];
+        squares[i] = square;
+        steps[i] = step;
+        sums[i] = step;
+      }
+    } break;
+    case Optimizer::Adam: {
+      const NeuroFloat scale = _scale;
+      const NeuroFloat rate = _rate;
+      const NeuroFloat rest1 = 1.0 - _momentum;
+      const NeuroFloat decay = AdamDecay;
+      const NeuroFloat rest2 = 1.0 - AdamDecay;
+      const NeuroFloat correction1 = _correction1;
+      const NeuroFloat correction2 = _correction2;
+      for (size_t i = 0; i < n; i++) {
+        auto g = scale * sums[i];
+        auto mean = momentum * steps[i] + rest1 * g;
+        auto square = decay * squares[i] + rest2 * g * g;
+        steps[i] = mean;
+        squares[i] = square;
+        sums[i] = rate * (mean * correction1) /
+                  (std::sqrt(square * correction2) + epsilon);
+      }
+    } break;
+    }
+  }
+
+private:
+  Optimizer _kind;
+  double _rate;
+  double _momentum;
+  double _scale;
+  double _correction1 = 1.0;
+  double _correction2 = 1.0;
+};
+} // namespace Nevolver
+
+#endif /* OPTIMIZER_H */
@@ -0,0 +1,1045 @@
+#ifndef PLAN_H
+#define PLAN_H
+
+#include "half.hpp"
+#include "nevolver.hpp"
+
+namespace Nevolver {
+/*
+A frozen, flat copy of a network ready for inference.
+Nodes are laid down in topological (sorted) order as structure of arrays,
+inbound connections are stored CSR style (per node ranges of source index,
+weight and gain slot) and squash functions become a small opcode.
+
+Gains live in their own table, slot 0 is the constant 1 used by every non
+gated connection, gaters write their activation into the slots they own just
+like HiddenNode::doFastActivate does with Connection::gain.
+
+The plan owns the transient state (state/old/activation) while it runs,
+pull() and push() move it from/to the actual nodes.
+
+Batches are swept node by node over chunks of BatchSize samples, each node
+row being plain streaming arithmetic. Squash rows are free to use vectorized
+math so batches match single activations within a few ulps, not bit for bit.
+
+Runs of consecutive nodes sharing the same leading inbound sources (what
+connect(Group, Group, AllToAll) builds) are detected and turned into dense
+blocks with a contiguous weight matrix, evaluated as matrix-vector (single)
+or matrix-matrix (batch) products. Whatever is left (gated or mutated
+connections) stays in the CSR ranges and is added after the dense part,
+per node accumulation order is unchanged. Single activations match the nodes
+bit for bit, given -fno-associative-math -ffp-contract=off next to
+-ffast-math. CMakeLists.txt sets them for every target, other builds
+including these headers need them too.
+
+Mostly sparse plans (evolved topologies) skip dense blocks and run from a
+sliced ELLPACK copy of the CSR instead, see buildSparse.
+
+With a 16 bit WeightStorage every weight and bias is rounded to it, dense
+matrices (the bulk of the weights) are kept packed and widened right
+before use, one panel column at a time.
+*/
+class ActivationPlan final {
+  friend class SourceExporter;
+  friend class QuantizedPlan;
+
+public:
+  constexpr static uint8_t InputOp = 0xFF;
+  constexpr static uint8_t SelfFlag = 0x1;
+  constexpr static uint8_t DenseFlag = 0x2;
+  constexpr static uint32_t NoBlock = 0xFFFFFFFF;
+  constexpr static size_t BatchSize = 64;
+  // nodes summed side by side by the sparse kernel
+  constexpr static size_t SliceLanes =
+      std::max(size_t(1), 8 * sizeof(float) / sizeof(NeuroFloat));
+  // dense weights are stored in panels of DensePanel rows
+  constexpr static size_t DensePanel =
+      std::max(size_t(1), 32 * sizeof(float) / sizeof(NeuroFloat));
+
+  // sortedNodes and inputs are node indices in graph
+  ActivationPlan(const Graph &graph, const std::vector<uint32_t> &sortedNodes,
+                 const std::vector<uint32_t> &inputs,
+                 WeightStorage storage = WeightStorage::Float)
+      : _storage(storage) {
+    const auto nsize = sortedNodes.size();
+    std::vector<uint32_t> nodeMap(graph.nodes.size(), NoIndex);
+    for (uint32_t i = 0; i < nsize; i++) {
+      nodeMap[sortedNodes[i]] = i;
+    }
+
+    _ops.resize(nsize);
+    _flags.resize(nsize, 0);
+    _bias.resize(nsize, 0);
+    _mask.resize(nsize, 1);
+    _selfW.resize(nsize, 0);
+    _selfGain.resize(nsize, 0);
+    _state.resize(nsize, 0);
+    _old.resize(nsize, 0);
+    _act.resize(nsize, 0);
+    _inStart.reserve(nsize + 1);
+    _gateStart.reserve(nsize + 1);
+    _nodes.reserve(nsize);
+
+    // slot 0 is the constant gain
+    _gains.emplace_back(1);
+    _gainConns.emplace_back(NoIndex);
+    std::unordered_map<uint32_t, uint32_t> gainMap;
+    std::unordered_map<uint32_t, uint32_t> slotGaters;
+    auto gainSlot = [&](uint32_t c) -> uint32_t {
+      // connections that are not gated and never were keep a gain of 1
+      auto &conn = graph.connections[c];
+      const NeuroFloat one(1);
+      if (conn.gater == NoIndex &&
+          std::memcmp(&conn.gain, &one, sizeof(NeuroFloat)) == 0)
+        return 0;
+      auto [it, added] = gainMap.emplace(c, uint32_t(_gains.size()));
+      if (added) {
+        _gains.emplace_back(conn.gain);
+        _gainConns.emplace_back(c);
+      }
+      return it->second;
+    };
+
+    for (uint32_t i = 0; i < nsize; i++) {
+      auto &vnode = graph.nodes[sortedNodes[i]];
+      _nodes.emplace_back(sortedNodes[i]);
+      _inStart.emplace_back(uint32_t(_inFrom.size()));
+      _gateStart.emplace_back(uint32_t(_gateSlots.size()));
+
+      if (graph.node(sortedNodes[i]).isOutput())
+        _outputs.emplace_back(i);
+
+      if (vnode.index() == 0) {
+        // inputs do nothing but hold their value
+        _ops[i] = InputOp;
+        continue;
+      }
+
+      auto &hidden = std::get<HiddenNode>(vnode);
+      _ops[i] = uint8_t(hidden._op);
+      _bias[i] = PackedWeight::round(storage, hidden._bias);
+      _mask[i] = hidden._mask;
+
+      auto &conns = hidden.connections();
+      if (conns.self != NoIndex) {
+        _flags[i] |= SelfFlag;
+        _selfW[i] = PackedWeight::round(
+            storage, graph.w(graph.connections[conns.self]));
+        _selfGain[i] = gainSlot(conns.self);
+      }
+
+      for (auto c : conns.inbound) {
+        auto &conn = graph.connections[c];
+        _inFrom.emplace_back(nodeMap[conn.from]);
+        _inW.emplace_back(PackedWeight::round(storage, graph.w(conn)));
+        _inGain.emplace_back(gainSlot(c));
+      }
+
+      for (auto conn : conns.gate) {
+        auto slot = gainSlot(conn);
+        _gateSlots.emplace_back(slot);
+        slotGaters[slot] = i;
+      }
+    }
+    _inStart.emplace_back(uint32_t(_inFrom.size()));
+    _gateStart.emplace_back(uint32_t(_gateSlots.size()));
+
+    // find out if samples depend on previous ones
+    // inputs are set before anything else so they never count
+    std::vector<bool> backSource(nsize, false);
+    for (uint32_t i = 0; i < nsize; i++) {
+      if (_flags[i] & SelfFlag)
+        _feedforward = false;
+      const auto end = _inStart[i + 1];
+      for (auto k = _inStart[i]; k < end; k++) {
+        auto from = _inFrom[k];
+        if (from >= i && _ops[from] != InputOp) {
+          _feedforward = false;
+          backSource[from] = true;
+        }
+        auto git = slotGaters.find(_inGain[k]);
+        if (git != slotGaters.end() && git->second >= i)
+          _feedforward = false;
+      }
+    }
+    for (uint32_t i = 0; i < nsize; i++) {
+      if (backSource[i])
+        _backSources.emplace_back(i);
+    }
+
+    for (auto input : inputs) {
+      _inputs.emplace_back(nodeMap[input]);
+    }
+
+    _gaterOf.assign(_gains.size(), NoBlock);
+    for (uint32_t i = 0; i < nsize; i++) {
+      const auto end = _gateStart[i + 1];
+      for (auto k = _gateStart[i]; k < end; k++) {
+        _gaterOf[_gateSlots[k]] = i;
+      }
+    }
+
+    buildDense();
+    if (_blocks.empty())
+      buildSparse();
+  }
+
+  // load transient state from the nodes of graph
+  void pull(const Graph &graph) {
+    const auto nsize = _nodes.size();
+    for (size_t i = 0; i < nsize; i++) {
+      auto &vnode = graph.nodes[_nodes[i]];
+      _act[i] = graph.node(_nodes[i]).current();
+      if (_ops[i] != InputOp) {
+        auto &hidden = std::get<HiddenNode>(vnode);
+        _state[i] = hidden._state;
+        _old[i] = hidden._old;
+      }
+    }
+    const auto gsize = _gains.size();
+    for (size_t i = 1; i < gsize; i++) {
+      _gains[i] = graph.connections[_gainConns[i]].gain;
+    }
+  }
+
+  // write transient state back into the nodes of graph
+  void push(const Graph &graph) const {
+    const auto nsize = _nodes.size();
+    for (size_t i = 0; i < nsize; i++) {
+      auto &vnode = graph.nodes[_nodes[i]];
+      if (_ops[i] == InputOp) {
+        std::get<InputNode>(vnode).setInput(_act[i]);
+      } else {
+        auto &hidden = std::get<HiddenNode>(vnode);
+        hidden._state = _state[i];
+        hidden._old = _old[i];
+        hidden._activation = _act[i];
+      }
+    }
+    const auto gsize = _gains.size();
+    for (size_t i = 1; i < gsize; i++) {
+      graph.connections[_gainConns[i]].gain = _gains[i];
+    }
+  }
+
+  template <typename SomeFloat, typename SomeFloatVector>
+  void activate(const SomeFloatVector &input, std::vector<SomeFloat> &output) {
+    output.clear();
+
+    auto isize = input.size();
+    if (isize != _inputs.size())
+      throw std::runtime_error(
+          "Invalid activation input size, differs from actual "
+          "network input size.");
+
+    for (size_t i = 0; i < isize; i++) {
+      _act[_inputs[i]] = input[i];
+    }
+
+    activateAll();
+
+    for (auto idx : _outputs) {
+      output.push_back(_act[idx]);
+    }
+  }
+
+  // Same results of activating the samples one after another,
+  // inputs are n rows of stride floats, outputs n rows of outputs count.
+  // Only feedforward plans can stream, others are activated sample by sample.
+  void activateBatch(const float *inputs, size_t n, size_t stride,
+                     float *outputs) {
+    if (_feedforward) {
+      activateChunks(inputs, n, stride, outputs, true);
+      return;
+    }
+
+    const auto isize = _inputs.size();
+    const auto osize = _outputs.size();
+    for (size_t s = 0; s < n; s++) {
+      auto input = inputs + s * stride;
+      for (size_t i = 0; i < isize; i++) {
+        _act[_inputs[i]] = input[i];
+      }
+
+      activateAll();
+
+      auto output = outputs + s * osize;
+      for (size_t o = 0; o < osize; o++) {
+        output[o] = mean(_act[_outputs[o]]);
+      }
+    }
+  }
+
+  // Every sample is activated independently, as if it was the only one.
+  // Recurrent inputs (self, backward connections, late gaters) all see
+  // the state the network had before the batch.
+  // Afterwards the state is the one of the last sample.
+  void activateBatchFeedforward(const float *inputs, size_t n, size_t stride,
+                                float *outputs) {
+    activateChunks(inputs, n, stride, outputs, false);
+  }
+
+  bool feedforward() const { return _feedforward; }
+
+  size_t inputs() const { return _inputs.size(); }
+
+  size_t outputs() const { return _outputs.size(); }
+
+  size_t size() const { return _nodes.size(); }
+
+  size_t connections() const {
+    size_t res = _inFrom.size();
+    for (auto &block : _blocks) {
+      res += block.rows * block.cols;
+    }
+    return res;
+  }
+
+  size_t denseBlocks() const { return _blocks.size(); }
+
+  bool sparse() const { return !_slices.empty(); }
+
+  WeightStorage storage() const { return _storage; }
+
+  // memory taken by weights and biases
+  size_t weightBytes() const {
+    return (_inW.size() + _selfW.size() + _bias.size() + _denseW.size()) *
+               sizeof(NeuroFloat) +
+           _denseW16.size() * sizeof(uint16_t);
+  }
+
+  // calls f(from, weight, gain slot) for the inbound connections of node i
+  // in accumulation order, dense part first
+  template <typename F> void inbound(size_t i, F &&f) const {
+    if (_blockOf[i] != NoBlock) {
+      auto &block = _blocks[_blockOf[i]];
+      const auto r = i - block.first;
+      for (size_t k = 0; k < block.cols; k++) {
+        f(_denseSrc[block.src + k], denseWeight(block, r, k), uint32_t(0));
+      }
+    }
+
+    const auto end = _inStart[i + 1];
+    for (auto k = _inStart[i]; k < end; k++) {
+      f(_inFrom[k], _inW[k], _inGain[k]);
+    }
+  }
+
+private:
+  NEVOLVER_INLINE static NeuroFloat squash(uint8_t op,
+                                           const NeuroFloat &input) {
+    return Squash::activate(SquashOp(op), input);
+  }
+
+  struct DenseBlock {
+    uint32_t first; // first node, rows are consecutive nodes
+    uint32_t rows;
+    uint32_t cols;
+    uint32_t src;   // offset in _denseSrc
+    size_t weights; // offset in _denseW
+  };
+
+  NEVOLVER_INLINE NeuroFloat denseWeight(const DenseBlock &block, size_t r,
+                                         size_t k) const {
+    const auto idx = block.weights +
+                     (r / DensePanel) * DensePanel * block.cols +
+                     k * DensePanel + r % DensePanel;
+    if (_storage == WeightStorage::Float)
+      return _denseW[idx];
+    return PackedWeight::unpack(_storage,
+                                &_denseW16[idx * PackedWeight::Lanes]);
+  }
+
+  // column k of a panel, widened into column if packed
+  template <WeightStorage S>
+  NEVOLVER_INLINE const NeuroFloat *denseColumn(size_t offset,
+                                                NeuroFloat *column) const {
+    if constexpr (S == WeightStorage::Float) {
+      return &_denseW[offset];
+    } else {
+      auto packed = &_denseW16[offset * PackedWeight::Lanes];
+      for (size_t r = 0; r < DensePanel; r++) {
+        column[r] =
+            PackedWeight::unpack(S, packed + r * PackedWeight::Lanes);
+      }
+      return column;
+    }
+  }
+
+  // the longest run of leading non gated inbound connections
+  uint32_t densePrefix(size_t i) const {
+    uint32_t len = 0;
+    const auto end = _inStart[i + 1];
+    for (auto k = _inStart[i]; k < end && _inGain[k] == 0; k++) {
+      len++;
+    }
+    return len;
+  }
+
+  void buildDense() {
+    const auto nsize = _nodes.size();
+    _blockOf.resize(nsize, NoBlock);
+
+    size_t i = 0;
+    while (i < nsize) {
+      auto cols = _ops[i] != InputOp ? densePrefix(i) : 0;
+      if (cols == 0) {
+        i++;
+        continue;
+      }
+
+      // grow the block while the dense work does not shrink
+      const auto first = i;
+      const auto fsrc = &_inFrom[_inStart[first]];
+      auto j = first + 1;
+      while (j < nsize && _ops[j] != InputOp) {
+        // rows are all initialized before any finishes, a self connection
+        // gated from within the block would read last step's gain
+        if (_flags[j] & SelfFlag) {
+          const auto gater = _gaterOf[_selfGain[j]];
+          if (gater != NoBlock && gater >= first && gater < j)
+            break;
+        }
+        const auto jsrc = &_inFrom[_inStart[j]];
+        uint32_t common = 0;
+        const auto jcols = std::min(cols, densePrefix(j));
+        while (common < jcols && fsrc[common] == jsrc[common] &&
+               // sources must be outside of the block
+               (fsrc[common] < first || fsrc[common] > j)) {
+          common++;
+        }
+        const auto rows = j - first;
+        if (common == 0 || (rows + 1) * common < rows * cols)
+          break;
+        cols = common;
+        j++;
+      }
+
+      const auto rows = j - first;
+      if (rows < 2) {
+        i++;
+        continue;
+      }
+
+      DenseBlock block{uint32_t(first), uint32_t(rows), cols,
+                       uint32_t(_denseSrc.size()), _denseW.size()};
+      _denseSrc.insert(_denseSrc.end(), fsrc, fsrc + cols);
+
+      // panels of DensePanel rows, column major within the panel
+      const auto panels = (rows + DensePanel - 1) / DensePanel;
+      _denseW.resize(_denseW.size() + panels * DensePanel * cols, 0);
+      for (size_t r = 0; r < rows; r++) {
+        auto panel = &_denseW[block.weights + (r / DensePanel) * DensePanel *
+                                                  cols];
+        const auto w = &_inW[_inStart[first + r]];
+        for (size_t k = 0; k < cols; k++) {
+          panel[k * DensePanel + r % DensePanel] = w[k];
+        }
+      }
+
+      if (_storage != WeightStorage::Float) {
+        // keep only the packed copy
+        _denseW16.resize(_denseW.size() * PackedWeight::Lanes);
+        for (size_t k = block.weights; k < _denseW.size(); k++) {
+          PackedWeight::pack(_storage, _denseW[k],
+                             &_denseW16[k * PackedWeight::Lanes]);
+        }
+      }
+
+      _flags[first] |= DenseFlag;
+      std::fill_n(&_blockOf[first], rows, uint32_t(_blocks.size()));
+      _blocks.emplace_back(block);
+      i = j;
+    }
+
+    if (_blocks.empty())
+      return;
+
+    // not worth it if most connections are left out
+    size_t dense = 0;
+    for (auto &block : _blocks) {
+      dense += size_t(block.rows) * block.cols;
+    }
+    if (dense * 2 < _inFrom.size()) {
+      for (auto &block : _blocks) {
+        _flags[block.first] &= ~DenseFlag;
+      }
+      std::fill(_blockOf.begin(), _blockOf.end(), NoBlock);
+      _blocks.clear();
+      _denseSrc.clear();
+      _denseW.clear();
+      _denseW16.clear();
+      return;
+    }
+
+    if (_storage != WeightStorage::Float) {
+      _denseW.clear();
+      _denseW.shrink_to_fit();
+    }
+
+    // drop the connections now owned by dense blocks
+    std::vector<uint32_t> skip(nsize, 0);
+    for (auto &block : _blocks) {
+      for (size_t r = 0; r < block.rows; r++) {
+        skip[block.first + r] = block.cols;
+      }
+    }
+
+    size_t pos = 0;
+    uint32_t start = 0;
+    for (size_t n = 0; n < nsize; n++) {
+      const auto end = _inStart[n + 1];
+      for (auto k = start + skip[n]; k < end; k++) {
+        _inFrom[pos] = _inFrom[k];
+        _inW[pos] = _inW[k];
+        _inGain[pos] = _inGain[k];
+        pos++;
+      }
+      start = end;
+      _inStart[n + 1] = uint32_t(pos);
+    }
+    _inFrom.resize(pos);
+    _inW.resize(pos);
+    _inGain.resize(pos);
+
+    size_t maxRows = 0, maxCols = 0;
+    for (auto &block : _blocks) {
+      maxRows = std::max(maxRows, size_t(block.rows));
+      maxCols = std::max(maxCols, size_t(block.cols));
+    }
+    _denseX.resize(maxCols);
+    _denseRows.resize(maxCols);
+    _denseAcc.resize(((maxRows + DensePanel - 1) / DensePanel) * DensePanel);
+  }
+
+  // calls f(writer) for every node whose output node i reads
+  template <typename F> void readsOf(size_t i, F &&f) const {
+    if (_flags[i] & SelfFlag && _gaterOf[_selfGain[i]] != NoBlock)
+      f(_gaterOf[_selfGain[i]]);
+    const auto end = _inStart[i + 1];
+    for (auto k = _inStart[i]; k < end; k++) {
+      f(_inFrom[k]);
+      if (_gaterOf[_inGain[k]] != NoBlock)
+        f(_gaterOf[_inGain[k]]);
+    }
+  }
+
+  // Sliced ELLPACK (SELL-C-sigma): nodes are put in levels, a level only
+  // reads activations and gains written by earlier levels or that must be
+  // read before later levels overwrite them. Nodes of a level are sorted
+  // by inbound count and cut into slices of SliceLanes nodes, connections
+  // of a slice are interleaved lane by lane so that one step gathers one
+  // connection per node. Every node still sums in connection order.
+  void buildSparse() {
+    const auto nsize = _nodes.size();
+
+    // readers of values a later node overwrites
+    std::vector<std::vector<uint32_t>> lateReaders(nsize);
+    for (uint32_t i = 0; i < nsize; i++) {
+      if (_ops[i] == InputOp)
+        continue;
+      readsOf(i, [&](uint32_t writer) {
+        if (writer > i && _ops[writer] != InputOp)
+          lateReaders[writer].emplace_back(i);
+      });
+    }
+
+    std::vector<uint32_t> level(nsize, 0);
+    std::vector<std::vector<uint32_t>> levels;
+    for (uint32_t i = 0; i < nsize; i++) {
+      if (_ops[i] == InputOp)
+        continue;
+      uint32_t l = 0;
+      readsOf(i, [&](uint32_t writer) {
+        if (writer < i && _ops[writer] != InputOp)
+          l = std::max(l, level[writer] + 1);
+      });
+      for (auto reader : lateReaders[i]) {
+        l = std::max(l, level[reader] + 1);
+      }
+      level[i] = l;
+      if (levels.size() <= l)
+        levels.resize(l + 1);
+      levels[l].emplace_back(i);
+    }
+
+    auto count = [&](uint32_t i) { return _inStart[i + 1] - _inStart[i]; };
+    for (auto &nodes : levels) {
+      std::stable_sort(nodes.begin(), nodes.end(), [&](auto a, auto b) {
+        return count(a) > count(b);
+      });
+
+      for (size_t n = 0; n < nodes.size(); n += SliceLanes) {
+        const auto lanes = std::min(SliceLanes, nodes.size() - n);
+        const auto len = count(nodes[n]);
+        _slices.push_back({uint32_t(_sliceNodes.size()), uint32_t(lanes), len,
+                           uint32_t(_sliceFrom.size())});
+
+        // unused lanes and steps point to node 0 with no weight
+        _sliceNodes.resize(_sliceNodes.size() + SliceLanes, 0);
+        _sliceLen.resize(_sliceLen.size() + SliceLanes, 0);
+        _sliceFrom.resize(_sliceFrom.size() + len * SliceLanes, 0);
+        _sliceW.resize(_sliceW.size() + len * SliceLanes, 0);
+        _sliceGain.resize(_sliceGain.size() + len * SliceLanes, 0);
+
+        auto &slice = _slices.back();
+        for (size_t l = 0; l < lanes; l++) {
+          const auto i = nodes[n + l];
+          _sliceNodes[slice.nodes + l] = i;
+          _sliceLen[slice.nodes + l] = count(i);
+          for (size_t k = 0; k < count(i); k++) {
+            const auto idx = slice.offset + k * SliceLanes + l;
+            _sliceFrom[idx] = _inFrom[_inStart[i] + k];
+            _sliceW[idx] = _inW[_inStart[i] + k];
+            _sliceGain[idx] = _inGain[_inStart[i] + k];
+          }
+        }
+      }
+    }
+
+    // chains of dependent nodes leave lanes idle, plain CSR is faster then
+    size_t hidden = 0;
+    for (auto &nodes : levels) {
+      hidden += nodes.size();
+    }
+    if (hidden * 4 < _slices.size() * SliceLanes * 3) {
+      _slices.clear();
+      _sliceNodes.clear();
+      _sliceLen.clear();
+      _sliceFrom.clear();
+      _sliceW.clear();
+      _sliceGain.clear();
+    }
+  }
+
+  NEVOLVER_DISPATCHED void activateAll() {
+    if (!_slices.empty()) {
+      activateSlices();
+      return;
+    }
+
+    const auto nsize = _nodes.size();
+    size_t i = 0;
+    while (i < nsize) {
+      if (_ops[i] == InputOp) {
+        i++;
+      } else if (_flags[i] & DenseFlag) {
+        auto &block = _blocks[_blockOf[i]];
+        switch (_storage) {
+        case WeightStorage::Float:
+          activateDense<WeightStorage::Float>(block);
+          break;
+        case WeightStorage::Half:
+          activateDense<WeightStorage::Half>(block);
+          break;
+        case WeightStorage::BFloat16:
+          activateDense<WeightStorage::BFloat16>(block);
+          break;
+        }
+        i += block.rows;
+      } else {
+        activateNode(i);
+        i++;
+      }
+    }
+  }
+
+  NEVOLVER_INLINE NeuroFloat initNode(size_t i) {
+    _old[i] = _state[i];
+
+    if (_flags[i] & SelfFlag) {
+      return _gains[_selfGain[i]] * _selfW[i] * _state[i] + _bias[i];
+    } else {
+      return _bias[i];
+    }
+  }
+
+  // mirrors HiddenNode::doFastActivate
+  NEVOLVER_INLINE void activateNode(size_t i) {
+    auto state = initNode(i);
+    finishNode(i, state);
+  }
+
+  template <WeightStorage S>
+  NEVOLVER_INLINE void activateDense(const DenseBlock &block) {
+    const auto cols = block.cols;
+    const auto src = &_denseSrc[block.src];
+    auto x = _denseX.data();
+    for (size_t k = 0; k < cols; k++) {
+      x[k] = _act[src[k]];
+    }
+
+    auto acc = _denseAcc.data();
+    for (size_t r = 0; r < block.rows; r++) {
+      acc[r] = initNode(block.first + r);
+    }
+
+    // matrix vector, each row still sums in connection order
+    const auto panels = (block.rows + DensePanel - 1) / DensePanel;
+    for (size_t p = 0; p < panels; p++) {
+      NeuroFloat sums[DensePanel];
+      std::copy_n(acc + p * DensePanel, DensePanel, sums);
+      auto offset = block.weights + p * DensePanel * cols;
+      for (size_t k = 0; k < cols; k++) {
+        NeuroFloat column[DensePanel];
+        const auto w = denseColumn<S>(offset, column);
+        const auto xk = x[k];
+        for (size_t r = 0; r < DensePanel; r++) {
+          sums[r] += xk * w[r];
+        }
+        offset += DensePanel;
+      }
+      std::copy_n(sums, DensePanel, acc + p * DensePanel);
+    }
+
+    for (size_t r = 0; r < block.rows; r++) {
+      finishNode(block.first + r, acc[r]);
+    }
+  }
+
+  NEVOLVER_INLINE void activateSlices() {
+    for (auto &slice : _slices) {
+      const auto nodes = &_sliceNodes[slice.nodes];
+      const auto lens = &_sliceLen[slice.nodes];
+      NeuroFloat acc[SliceLanes];
+      for (size_t l = 0; l < SliceLanes; l++) {
+        acc[l] = l < slice.lanes ? initNode(nodes[l]) : NeuroFloat(0);
+      }
+
+      auto from = &_sliceFrom[slice.offset];
+      auto w = &_sliceW[slice.offset];
+      auto gain = &_sliceGain[slice.offset];
+      // lanes are sorted by length, all of them are busy up to the last one
+      // (lane loops are kept rolled, so that they vectorize as gathers)
+      size_t k = 0;
+      for (; k < lens[slice.lanes - 1]; k++) {
+#pragma GCC unroll 1
+        for (size_t l = 0; l < SliceLanes; l++) {
+          acc[l] += _act[from[l]] * w[l] * _gains[gain[l]];
+        }
+        from += SliceLanes;
+        w += SliceLanes;
+        gain += SliceLanes;
+      }
+      for (; k < slice.len; k++) {
+#pragma GCC unroll 1
+        for (size_t l = 0; l < SliceLanes; l++) {
+          const auto term = _act[from[l]] * w[l] * _gains[gain[l]];
+          acc[l] = k < lens[l] ? acc[l] + term : acc[l];
+        }
+        from += SliceLanes;
+        w += SliceLanes;
+        gain += SliceLanes;
+      }
+
+      for (size_t l = 0; l < slice.lanes; l++) {
+        completeNode(nodes[l], acc[l]);
+      }
+    }
+  }
+
+  // sparse leftovers, squash and gating
+  NEVOLVER_INLINE void finishNode(size_t i, NeuroFloat state) {
+    const auto end = _inStart[i + 1];
+    for (auto k = _inStart[i]; k < end; k++) {
+      state += _act[_inFrom[k]] * _inW[k] * _gains[_inGain[k]];
+    }
+    completeNode(i, state);
+  }
+
+  NEVOLVER_INLINE void completeNode(size_t i, const NeuroFloat &state) {
+    _state[i] = state;
+    auto fwd = squash(_ops[i], state);
+    auto activation = fwd * _mask[i];
+    _act[i] = activation;
+
+    const auto gend = _gateStart[i + 1];
+    for (auto k = _gateStart[i]; k < gend; k++) {
+      _gains[_gateSlots[k]] = activation;
+    }
+  }
+
+  template <size_t I = 0>
+  NEVOLVER_INLINE static void squashRow(uint8_t op, const NeuroFloat *input,
+                                        const NeuroFloat &mask,
+                                        NeuroFloat *output, size_t n) {
+    if constexpr (I < std::variant_size_v<SquashFunc>) {
+      if (op == I) {
+        const std::variant_alternative_t<I, SquashFunc> f{};
+        for (size_t s = 0; s < n; s++) {
+          output[s] = f(input[s]) * mask;
+        }
+        return;
+      }
+      squashRow<I + 1>(op, input, mask, output, n);
+    }
+  }
+
+  NEVOLVER_DISPATCHED void activateChunks(const float *inputs, size_t n,
+                                          size_t stride, float *outputs,
+                                          bool sequential) {
+    const auto nsize = _nodes.size();
+    const auto gsize = _gains.size();
+    const auto isize = _inputs.size();
+    const auto osize = _outputs.size();
+
+    _batchAct.resize(nsize * BatchSize);
+    _batchState.resize(nsize * BatchSize);
+    _batchGains.resize(gsize * BatchSize);
+    _lastState = _state;
+    _prevState = _state;
+    _lastGains = _gains;
+
+    for (size_t start = 0; start < n; start += BatchSize) {
+      const auto b = std::min(BatchSize, n - start);
+
+      for (size_t i = 0; i < isize; i++) {
+        auto row = &_batchAct[_inputs[i] * BatchSize];
+        auto input = inputs + start * stride + i;
+        for (size_t s = 0; s < b; s++) {
+          row[s] = input[s * stride];
+        }
+      }
+
+      for (auto i : _backSources) {
+        std::fill_n(&_batchAct[i * BatchSize], b, _act[i]);
+      }
+
+      for (size_t g = 0; g < gsize; g++) {
+        std::fill_n(&_batchGains[g * BatchSize], b, _gains[g]);
+      }
+
+      size_t i = 0;
+      while (i < nsize) {
+        if (_ops[i] == InputOp) {
+          i++;
+        } else if (_flags[i] & DenseFlag) {
+          auto &block = _blocks[_blockOf[i]];
+          activateDenseRows(block, b);
+          i += block.rows;
+        } else {
+          activateRow(i, b);
+          i++;
+        }
+      }
+
+      for (size_t o = 0; o < osize; o++) {
+        auto row = &_batchAct[_outputs[o] * BatchSize];
+        auto output = outputs + start * osize + o;
+        for (size_t s = 0; s < b; s++) {
+          output[s * osize] = mean(row[s]);
+        }
+      }
+
+      // keep track of the last two states, to fill state and old
+      for (size_t i = 0; i < nsize; i++) {
+        auto row = &_batchState[i * BatchSize];
+        _prevState[i] = b > 1 ? row[b - 2] : _lastState[i];
+        _lastState[i] = row[b - 1];
+      }
+      for (size_t g = 1; g < gsize; g++) {
+        _lastGains[g] = _batchGains[g * BatchSize + b - 1];
+      }
+
+      if (start + b >= n) {
+        for (size_t i = 0; i < nsize; i++) {
+          _act[i] = _batchAct[i * BatchSize + b - 1];
+        }
+      }
+    }
+
+    if (n == 0)
+      return;
+
+    for (size_t i = 0; i < nsize; i++) {
+      if (_ops[i] == InputOp)
+        continue;
+      _old[i] = sequential ? _prevState[i] : _state[i];
+      _state[i] = _lastState[i];
+    }
+    _gains.swap(_lastGains);
+  }
+
+  NEVOLVER_INLINE void initRow(size_t i, size_t b) {
+    auto state = &_batchState[i * BatchSize];
+
+    if (_flags[i] & SelfFlag) {
+      auto gains = &_batchGains[_selfGain[i] * BatchSize];
+      for (size_t s = 0; s < b; s++) {
+        state[s] = gains[s] * _selfW[i] * _state[i] + _bias[i];
+      }
+    } else {
+      std::fill_n(state, b, _bias[i]);
+    }
+  }
+
+  // activateNode over a chunk of samples
+  NEVOLVER_INLINE void activateRow(size_t i, size_t b) {
+    initRow(i, b);
+    finishRow(i, b);
+  }
+
+  // activateDense over a chunk of samples
+  // rows of the block are consecutive in _batchState
+  NEVOLVER_INLINE void activateDenseRows(const DenseBlock &block, size_t b) {
+    constexpr size_t TileRows = 4;
+    constexpr size_t TileSamples = 16;
+
+    const auto cols = block.cols;
+    const auto src = &_denseSrc[block.src];
+    auto x = _denseRows.data();
+    for (size_t k = 0; k < cols; k++) {
+      x[k] = &_batchAct[src[k] * BatchSize];
+    }
+
+    for (size_t r = 0; r < block.rows; r++) {
+      initRow(block.first + r, b);
+    }
+
+    auto weight = [&](size_t r, size_t k) {
+      return denseWeight(block, r, k);
+    };
+
+    // matrix matrix, tiles of TileRows x TileSamples stay in registers
+    for (size_t r = 0; r < block.rows; r += TileRows) {
+      const auto rows = std::min(TileRows, block.rows - r);
+      for (size_t s0 = 0; s0 < b; s0 += TileSamples) {
+        const auto samples = std::min(TileSamples, b - s0);
+        if (rows == TileRows && samples == TileSamples) {
+          NeuroFloat tile[TileRows][TileSamples];
+          for (size_t j = 0; j < TileRows; j++) {
+            std::copy_n(&_batchState[(block.first + r + j) * BatchSize + s0],
+                        TileSamples, tile[j]);
+          }
+          for (size_t k = 0; k < cols; k++) {
+            const auto row = x[k] + s0;
+            for (size_t j = 0; j < TileRows; j++) {
+              const auto w = weight(r + j, k);
+              for (size_t s = 0; s < TileSamples; s++) {
+                tile[j][s] += row[s] * w;
+              }
+            }
+          }
+          for (size_t j = 0; j < TileRows; j++) {
+            std::copy_n(tile[j], TileSamples,
+                        &_batchState[(block.first + r + j) * BatchSize + s0]);
+          }
+        } else {
+          for (size_t j = 0; j < rows; j++) {
+            auto state = &_batchState[(block.first + r + j) * BatchSize + s0];
+            for (size_t k = 0; k < cols; k++) {
+              const auto row = x[k] + s0;
+              const auto w = weight(r + j, k);
+              for (size_t s = 0; s < samples; s++) {
+                state[s] += row[s] * w;
+              }
+            }
+          }
+        }
+      }
+    }
+
+    for (size_t r = 0; r < block.rows; r++) {
+      finishRow(block.first + r, b);
+    }
+  }
+
+  // sparse leftovers, squash and gating over a chunk of samples
+  NEVOLVER_INLINE void finishRow(size_t i, size_t b) {
+    auto state = &_batchState[i * BatchSize];
+
+    const auto end = _inStart[i + 1];
+    for (auto k = _inStart[i]; k < end; k++) {
+      auto from = &_batchAct[_inFrom[k] * BatchSize];
+      const auto w = _inW[k];
+      if (_inGain[k] == 0) {
+        // constant 1 gain, x * 1 is exact
+        for (size_t s = 0; s < b; s++) {
+          state[s] += from[s] * w;
+        }
+      } else {
+        auto gains = &_batchGains[_inGain[k] * BatchSize];
+        for (size_t s = 0; s < b; s++) {
+          state[s] += from[s] * w * gains[s];
+        }
+      }
+    }
+
+    auto act = &_batchAct[i * BatchSize];
+    squashRow(_ops[i], state, _mask[i], act, b);
+
+    const auto gend = _gateStart[i + 1];
+    for (auto k = _gateStart[i]; k < gend; k++) {
+      std::copy_n(act, b, &_batchGains[_gateSlots[k] * BatchSize]);
+    }
+  }
+
+  // per node
+  std::vector<uint8_t> _ops;
+  std::vector<uint8_t> _flags;
+  std::vector<NeuroFloat> _bias;
+  std::vector<NeuroFloat> _mask;
+  std::vector<NeuroFloat> _selfW;
+  std::vector<uint32_t> _selfGain;
+  std::vector<NeuroFloat> _state;
+  std::vector<NeuroFloat> _old;
+  std::vector<NeuroFloat> _act;
+
+  // CSR inbound connections
+  std::vector<uint32_t> _inStart;
+  std::vector<uint32_t> _inFrom;
+  std::vector<NeuroFloat> _inW;
+  std::vector<uint32_t> _inGain;
+
+  // CSR gated connections, by gater
+  std::vector<uint32_t> _gateStart;
+  std::vector<uint32_t> _gateSlots;
+  std::vector<NeuroFloat> _gains;
+
+  // dense blocks
+  std::vector<DenseBlock> _blocks;
+  std::vector<uint32_t> _blockOf;
+  std::vector<uint32_t> _denseSrc;
+  std::vector<NeuroFloat> _denseW;
+  std::vector<uint16_t> _denseW16; // packed lanes, replaces _denseW
+  std::vector<NeuroFloat> _denseX;
+  std::vector<NeuroFloat> _denseAcc;
+  std::vector<const NeuroFloat *> _denseRows;
+
+  // sliced ELLPACK, sparse plans only
+  struct Slice {
+    uint32_t nodes;  // offset in _sliceNodes/_sliceLen, SliceLanes entries
+    uint32_t lanes;  // used lanes
+    uint32_t len;    // longest row
+    uint32_t offset; // in _sliceFrom/_sliceW/_sliceGain, len x SliceLanes
+  };
+  std::vector<Slice> _slices;
+  std::vector<uint32_t> _sliceNodes;
+  std::vector<uint32_t> _sliceLen;
+  std::vector<uint32_t> _sliceFrom;
+  std::vector<NeuroFloat> _sliceW;
+  std::vector<uint32_t> _sliceGain;
+  std::vector<uint32_t> _gaterOf; // gain slot -> gater node
+
+  std::vector<uint32_t> _inputs;
+  std::vector<uint32_t> _outputs;
+
+  WeightStorage _storage;
+  bool _feedforward = true;
+  std::vector<uint32_t> _backSources;
+
+  // batch scratch, node (or gain slot) major
+  std::vector<NeuroFloat> _batchAct;
+  std::vector<NeuroFloat> _batchState;
+  std::vector<NeuroFloat> _batchGains;
+  std::vector<NeuroFloat> _lastState;
+  std::vector<NeuroFloat> _prevState;
+  std::vector<NeuroFloat> _lastGains;
+
+  // used only to sync state, graph node and connection indices
+  std::vector<uint32_t> _nodes;
+  std::vector<uint32_t> _gainConns;
+};
+} // namespace Nevolver
+
+#endif /* PLAN_H */
@@ -0,0 +1,383 @@
+#ifndef QUANTIZE_H
+#define QUANTIZE_H
+
+#include "nevolver.hpp"
+#include "plan.hpp"
+
+namespace Nevolver {
+#ifndef NEVOLVER_WIDE
+/*
+An int8 copy of an activation plan.
+
+Every node activation also lives as int8 with its own scale, found running
+the float plan over a calibration set. Non gated inbound weights are
+premultiplied by the scale of their source and quantized with one scale per
+target node, so the sum of a node is a plain int8 x int8 -> int32 dot
+product and a single multiply back to float. Dense blocks keep their int8
+matrix row major, inputs are gathered next to it.
+
+Biases, self connections and gated connections stay float, squashes are
+read from lookup tables (linear interpolation) or evaluated exactly when
+piecewise linear.
+*/
+class QuantizedPlan final {
+public:
+  constexpr static size_t LutSize = 1024;
+  constexpr static float LutRange = 8.0f;
+
+  // accuracy against the float network
+  struct Report {
+    size_t samples = 0;
+    double maxError = 0.0;
+    double meanError = 0.0;
+    double rmsError = 0.0;
+    std::vector<double> maxErrors; // per output
+  };
+
+  QuantizedPlan(ActivationPlan &plan,
+                const std::vector<std::vector<NeuroFloat>> &calibration) {
+    const auto nsize = plan._nodes.size();
+    _ops = plan._ops;
+    _flags = plan._flags;
+    _bias = plan._bias;
+    _mask = plan._mask;
+    _selfW = plan._selfW;
+    _selfGain = plan._selfGain;
+    _gateStart = plan._gateStart;
+    _gateSlots = plan._gateSlots;
+    _inputs = plan._inputs;
+    _outputs = plan._outputs;
+
+    _initState = plan._state;
+    _initAct = plan._act;
+    _initGains = plan._gains;
+
+    // activation ranges
+    std::vector<float> range(nsize, 0.0f);
+    std::vector<NeuroFloat> output;
+    for (auto &input : calibration) {
+      plan.activate(input, output);
+      for (size_t i = 0; i < nsize; i++) {
+        range[i] = std::max(range[i], std::fabs(plan._act[i]));
+      }
+    }
+    _actScale.resize(nsize);
+    _invActScale.resize(nsize);
+    for (size_t i = 0; i < nsize; i++) {
+      _actScale[i] = std::max(range[i], 1e-6f) / 127.0f;
+      _invActScale[i] = 1.0f / _actScale[i];
+    }
+
+    // inbound connections, dense blocks first like the float plan
+    _nodeScale.resize(nsize, 0.0f);
+    _blockOf.resize(nsize, ActivationPlan::NoBlock);
+    _qStart.reserve(nsize + 1);
+    _fStart.reserve(nsize + 1);
+    std::vector<uint32_t> sources;
+    std::vector<float> weights;
+    for (uint32_t i = 0; i < nsize; i++) {
+      _qStart.emplace_back(uint32_t(_qFrom.size()));
+      _fStart.emplace_back(uint32_t(_fFrom.size()));
+      if (_ops[i] == ActivationPlan::InputOp)
+        continue;
+
+      sources.clear();
+      weights.clear();
+      plan.inbound(i, [&](uint32_t from, NeuroFloat w, uint32_t gain) {
+        if (gain == 0) {
+          sources.emplace_back(from);
+          weights.emplace_back(w * _actScale[from]);
+        } else {
+          _fFrom.emplace_back(from);
+          _fW.emplace_back(w);
+          _fGain.emplace_back(gain);
+        }
+      });
+
+      float max = 0.0f;
+      for (auto w : weights) {
+        max = std::max(max, std::fabs(w));
+      }
+      _nodeScale[i] = max / 127.0f;
+      const auto inv = max > 0.0f ? 127.0f / max : 0.0f;
+
+      size_t k = 0;
+      if (plan._blockOf[i] != ActivationPlan::NoBlock) {
+        auto &block = plan._blocks[plan._blockOf[i]];
+        if (i == block.first) {
+          _blocks.push_back({block.first, block.rows, block.cols,
+                             uint32_t(_blockSrc.size()),
+                             uint32_t(_blockW.size())});
+          _blockSrc.insert(_blockSrc.end(), sources.begin(),
+                           sources.begin() + block.cols);
+          _blockW.resize(_blockW.size() + size_t(block.rows) * block.cols);
+        }
+        _blockOf[i] = uint32_t(_blocks.size() - 1);
+
+        auto &qblock = _blocks.back();
+        auto row = &_blockW[qblock.weights + (i - block.first) * block.cols];
+        for (; k < block.cols; k++) {
+          row[k] = quantize(weights[k] * inv);
+        }
+      }
+
+      for (; k < sources.size(); k++) {
+        _qFrom.emplace_back(sources[k]);
+        _qW.emplace_back(quantize(weights[k] * inv));
+      }
+    }
+    _qStart.emplace_back(uint32_t(_qFrom.size()));
+    _fStart.emplace_back(uint32_t(_fFrom.size()));
+
+    size_t maxCols = 0;
+    for (auto &block : _blocks) {
+      maxCols = std::max(maxCols, size_t(block.cols));
+    }
+    _x.resize(maxCols);
+
+    reset();
+  }
+
+  // back to the state the network had when quantized
+  void reset() {
+    _state = _initState;
+    _act = _initAct;
+    _gains = _initGains;
+    _qact.resize(_act.size());
+    for (size_t i = 0; i < _act.size(); i++) {
+      _qact[i] = quantize(_act[i] * _invActScale[i]);
+    }
+  }
+
+  template <typename SomeFloat, typename SomeFloatVector>
+  void activate(const SomeFloatVector &input, std::vector<SomeFloat> &output) {
+    output.clear();
+
+    auto isize = input.size();
+    if (isize != _inputs.size())
+      throw std::runtime_error(
+          "Invalid activation input size, differs from actual "
+          "network input size.");
+
+    for (size_t i = 0; i < isize; i++) {
+      auto idx = _inputs[i];
+      _act[idx] = input[i];
+      _qact[idx] = quantize(_act[idx] * _invActScale[idx]);
+    }
+
+    activateAll();
+
+    for (auto idx : _outputs) {
+      output.push_back(_act[idx]);
+    }
+  }
+
+  size_t inputs() const { return _inputs.size(); }
+
+  size_t outputs() const { return _outputs.size(); }
+
+  // bytes of quantized weights, the float plan needs 4x that
+  size_t weightBytes() const { return _qW.size() + _blockW.size(); }
+
+private:
+  struct Block {
+    uint32_t first;
+    uint32_t rows;
+    uint32_t cols;
+    uint32_t src;
+    uint32_t weights;
+  };
+
+  // Non finite values are told apart on their bits, -ffast-math folds
+  // isnan away: NaN maps to 0, infinities saturate.
+  NEVOLVER_INLINE static int8_t quantize(float value) {
+    uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(float));
+    if ((bits & 0x7F800000) == 0x7F800000) {
+      if (bits & 0x007FFFFF)
+        return 0;
+      return bits & 0x80000000 ? -127 : 127;
+    }
+    auto q = std::nearbyint(value);
+    return int8_t(std::min(127.0f, std::max(-127.0f, q)));
+  }
+
+  NEVOLVER_DISPATCHED void activateAll() {
+    const auto nsize = _ops.size();
+    size_t i = 0;
+    while (i < nsize) {
+      if (_ops[i] == ActivationPlan::InputOp) {
+        i++;
+      } else if (_blockOf[i] != ActivationPlan::NoBlock) {
+        auto &block = _blocks[_blockOf[i]];
+        const auto src = &_blockSrc[block.src];
+        for (size_t k = 0; k < block.cols; k++) {
+          _x[k] = _qact[src[k]];
+        }
+
+        // four rows at a time share the loads of x
+        const auto cols = block.cols;
+        size_t r = 0;
+        for (; r + 4 <= block.rows; r += 4) {
+          int32_t acc[4];
+          dot4(&_blockW[block.weights + r * cols], _x.data(), cols, acc);
+          for (size_t t = 0; t < 4; t++) {
+            activateNode(block.first + r + t, acc[t]);
+          }
+        }
+        for (; r < block.rows; r++) {
+          auto row = &_blockW[block.weights + r * cols];
+          activateNode(block.first + r, dot(row, _x.data(), cols));
+        }
+        i += block.rows;
+      } else {
+        activateNode(i, 0);
+        i++;
+      }
+    }
+  }
+
+  // x widened to int16 lets the compiler use multiply add instructions
+  NEVOLVER_INLINE static int32_t dot(const int8_t *w, const int16_t *x,
+                                     size_t n) {
+    int32_t acc = 0;
+    for (size_t k = 0; k < n; k++) {
+      acc += int32_t(int16_t(w[k])) * int32_t(x[k]);
+    }
+    return acc;
+  }
+
+  NEVOLVER_INLINE static void dot4(const int8_t *w, const int16_t *x,
+                                   size_t n, int32_t *acc) {
+    int32_t a0 = 0, a1 = 0, a2 = 0, a3 = 0;
+    for (size_t k = 0; k < n; k++) {
+      const int32_t xk = x[k];
+      a0 += int32_t(int16_t(w[k])) * xk;
+      a1 += int32_t(int16_t(w[n + k])) * xk;
+      a2 += int32_t(int16_t(w[2 * n + k])) * xk;
+      a3 += int32_t(int16_t(w[3 * n + k])) * xk;
+    }
+    acc[0] = a0;
+    acc[1] = a1;
+    acc[2] = a2;
+    acc[3] = a3;
+  }
+
+  NEVOLVER_INLINE void activateNode(size_t i, int32_t acc) {
+    const auto end = _qStart[i + 1];
+    for (auto k = _qStart[i]; k < end; k++) {
+      acc += int32_t(_qW[k]) * int32_t(_qact[_qFrom[k]]);
+    }
+
+    float state;
+    if (_flags[i] & ActivationPlan::SelfFlag) {
+      state = _gains[_selfGain[i]] * _selfW[i] * _state[i] + _bias[i];
+    } else {
+      state = _bias[i];
+    }
+    state += float(acc) * _nodeScale[i];
+
+    const auto fend = _fStart[i + 1];
+    for (auto k = _fStart[i]; k < fend; k++) {
+      state += _act[_fFrom[k]] * _fW[k] * _gains[_fGain[k]];
+    }
+
+    _state[i] = state;
+    auto activation = squash(SquashOp(_ops[i]), state) * _mask[i];
+    _act[i] = activation;
+    _qact[i] = quantize(activation * _invActScale[i]);
+
+    const auto gend = _gateStart[i + 1];
+    for (auto k = _gateStart[i]; k < gend; k++) {
+      _gains[_gateSlots[k]] = activation;
+    }
+  }
+
+  struct Lut {
+    Lut() {
+      for (size_t op = 0; op < size_t(SquashOp::Count); op++) {
+        for (size_t k = 0; k <= LutSize; k++) {
+          auto x = -LutRange + 2.0f * LutRange * float(k) / LutSize;
+          values[op][k] = Squash::activate(SquashOp(op), x);
+        }
+      }
+    }
+
+    float values[size_t(SquashOp::Count)][LutSize + 1];
+  };
+
+  // built once at load, a function local static pays a guard every call
+  static inline const Lut _lut{};
+
+  NEVOLVER_INLINE static float squash(SquashOp op, float x) {
+    switch (op) {
+    case SquashOp::Sigmoid:
+    case SquashOp::Tanh:
+    case SquashOp::Softsign:
+    case SquashOp::Sin:
+    case SquashOp::Gaussian:
+    case SquashOp::BentIdentity:
+    case SquashOp::BipolarSigmoid:
+    case SquashOp::Selu: {
+      auto t = (x + LutRange) * (LutSize / (2.0f * LutRange));
+      if (t >= 0.0f && t < float(LutSize)) {
+        auto k = size_t(t);
+        auto f = t - float(k);
+        auto &values = _lut.values[size_t(op)];
+        return values[k] + (values[k + 1] - values[k]) * f;
+      }
+    } break;
+    default:
+      // piecewise linear, exact is as cheap as a table
+      break;
+    }
+    return Squash::activate(op, x);
+  }
+
+  std::vector<uint8_t> _ops;
+  std::vector<uint8_t> _flags;
+  std::vector<NeuroFloat> _bias;
+  std::vector<NeuroFloat> _mask;
+  std::vector<NeuroFloat> _selfW;
+  std::vector<uint32_t> _selfGain;
+
+  std::vector<float> _actScale;
+  std::vector<float> _invActScale;
+  std::vector<float> _nodeScale;
+
+  // int8 sparse inbound
+  std::vector<uint32_t> _qStart;
+  std::vector<uint32_t> _qFrom;
+  std::vector<int8_t> _qW;
+
+  // int8 dense blocks
+  std::vector<Block> _blocks;
+  std::vector<uint32_t> _blockOf;
+  std::vector<uint32_t> _blockSrc;
+  std::vector<int8_t> _blockW;
+  std::vector<int16_t> _x;
+
+  // float gated inbound
+  std::vector<uint32_t> _fStart;
+  std::vector<uint32_t> _fFrom;
+  std::vector<NeuroFloat> _fW;
+  std::vector<uint32_t> _fGain;
+
+  std::vector<uint32_t> _gateStart;
+  std::vector<uint32_t> _gateSlots;
+  std::vector<uint32_t> _inputs;
+  std::vector<uint32_t> _outputs;
+
+  std::vector<NeuroFloat> _state;
+  std::vector<NeuroFloat> _act;
+  std::vector<NeuroFloat> _gains;
+  std::vector<int8_t> _qact;
+
+  std::vector<NeuroFloat> _initState;
+  std::vector<NeuroFloat> _initAct;
+  std::vector<NeuroFloat> _initGains;
+};
+#endif
+} // namespace Nevolver
+
+#endif /* QUANTIZE_H */
@@ -35,6 +35,12 @@ struct TanhS final : public SquashBase {
   NeuroFloat operator()(const NeuroFloat &input) const {
     return std::tanh(input);
   }
+
+  NeuroFloat operator()(const NeuroFloat &input, NeuroFloat &derivative) const {
+    auto fwd = std::tanh(input);
+    derivative = 1.0 - std::pow(fwd, 2);
+    return fwd;
+  }
 };
 
 struct TanhD final : public SquashBase {
@@ -83,6 +89,12 @@ struct SoftsignS final : public SquashBase {
   NeuroFloat operator()(const NeuroFloat &input) const {
     return input / (1.0 + std::fabs(input));
   }
+
+  NeuroFloat operator()(const NeuroFloat &input, NeuroFloat &derivative) const {
+    auto div = 1.0 + std::fabs(input);
+    derivative = 1.0 / std::pow(div, 2.0);
+    return input / div;
+  }
 };
 
 struct SoftsignD final : public SquashBase {
@@ -119,6 +131,12 @@ struct BentIdentityS final : public SquashBase {
   NeuroFloat operator()(const NeuroFloat &input) const {
     return (std::sqrt(std::pow(input, 2.0) + 1.0) - 1.0) / 2.0 + input;
   }
+
+  NeuroFloat operator()(const NeuroFloat &input, NeuroFloat &derivative) const {
+    auto root = std::sqrt(std::pow(input, 2.0) + 1.0);
+    derivative = input / (2.0 * root) + 1.0;
+    return (root - 1.0) / 2.0 + input;
+  }
 };
 
 struct BentIdentityD final : public SquashBase {
@@ -195,6 +213,13 @@ struct SeluS final : public SeluBase {
     auto fx = either(input > 0.0, input, alpha * (std::exp(input) - 1.0));
     return fx * scale;
   }
+
+  NeuroFloat operator()(const NeuroFloat &input, NeuroFloat &derivative) const {
+    auto exp = std::exp(input);
+    auto positive = input > 0.0;
+    derivative = either(positive, scale, alpha * exp * scale);
+    return either(positive, input, alpha * (exp - 1.0)) * scale;
+  }
 };
 
 struct SeluD final : public SeluBase {
@@ -212,6 +237,27 @@ using DeriveFunc =
                  SoftsignD, SinD, GaussianD, BentIdentityD, BipolarD,
                  BipolarSigmoidD, HardTanhD, AbsoluteD, InverseD, SeluD>;
 
+// SquashFunc/DeriveFunc alternatives as a compact opcode, same order
+enum class SquashOp : uint8_t {
+  Identity,
+  Sigmoid,
+  Tanh,
+  Relu,
+  LeakyRelu,
+  Step,
+  Softsign,
+  Sin,
+  Gaussian,
+  BentIdentity,
+  Bipolar,
+  BipolarSigmoid,
+  HardTanh,
+  Absolute,
+  Inverse,
+  Selu,
+  Count
+};
+
 struct Squash final {
   const static inline std::array<SquashFunc, 16> SFuncs{
       IdentityS(),  SigmoidS(),      TanhS(),     ReluS(),
@@ -225,12 +271,88 @@ struct Squash final {
       GaussianD(),  BentIdentityD(), BipolarD(),  BipolarSigmoidD(),
       HardTanhD(),  AbsoluteD(),     InverseD(),  SeluD()};
 
-  static const std::pair<SquashFunc, DeriveFunc> random() {
+  static SquashOp randomOp() {
     auto idx = Random::nextUInt() % SFuncs.size();
     assert(idx < SFuncs.size());
+    return SquashOp(idx);
+  }
+
+  static const std::pair<SquashFunc, DeriveFunc> random() {
+    auto idx = size_t(randomOp());
     return std::make_pair(SFuncs[idx], DFuncs[idx]);
   }
+
+  NEVOLVER_INLINE static NeuroFloat activate(SquashOp op,
+                                             const NeuroFloat &input) {
+    return dispatch(op, [&](auto s, auto d) { return s(input); });
+  }
+
+  // forward value and derivative in one go
+  NEVOLVER_INLINE static NeuroFloat
+  activate(SquashOp op, const NeuroFloat &input, NeuroFloat &derivative) {
+    return dispatch(op, [&](auto s, auto d) {
+      if constexpr (std::is_invocable_v<decltype(s), const NeuroFloat &,
+                                        NeuroFloat &>) {
+        return s(input, derivative);
+      } else {
+        auto fwd = s(input);
+        derivative = d(input, fwd);
+        return fwd;
+      }
+    });
+  }
+
+  NEVOLVER_INLINE static NeuroFloat derive(SquashOp op,
+                                           const NeuroFloat &state,
+                                           const NeuroFloat &fwd) {
+    return dispatch(op, [&](auto s, auto d) { return d(state, fwd); });
+  }
+
+private:
+  // calls f with the squash and derive functors of op
+  template <typename F>
+  NEVOLVER_INLINE static NeuroFloat dispatch(SquashOp op, F &&f) {
+    switch (op) {
+    case SquashOp::Identity:
+      return f(IdentityS(), IdentityD());
+    case SquashOp::Sigmoid:
+      return f(SigmoidS(), SigmoidD());
+    case SquashOp::Tanh:
+      return f(TanhS(), TanhD());
+    case SquashOp::Relu:
+      return f(ReluS(), ReluD());
+    case SquashOp::LeakyRelu:
+      return f(LeakyReluS(), LeakyReluD());
+    case SquashOp::Step:
+      return f(StepS(), StepD());
+    case SquashOp::Softsign:
+      return f(SoftsignS(), SoftsignD());
+    case SquashOp::Sin:
+      return f(SinS(), SinD());
+    case SquashOp::Gaussian:
+      return f(GaussianS(), GaussianD());
+    case SquashOp::BentIdentity:
+      return f(BentIdentityS(), BentIdentityD());
+    case SquashOp::Bipolar:
+      return f(BipolarS(), BipolarD());
+    case SquashOp::BipolarSigmoid:
+      return f(BipolarSigmoidS(), BipolarSigmoidD());
+    case SquashOp::HardTanh:
+      return f(HardTanhS(), HardTanhD());
+    case SquashOp::Absolute:
+      return f(AbsoluteS(), AbsoluteD());
+    case SquashOp::Inverse:
+      return f(InverseS(), InverseD());
+    case SquashOp::Selu:
+      return f(SeluS(), SeluD());
+    default:
+      return f(IdentityS(), IdentityD());
+    }
+  }
 };
+
+static_assert(size_t(SquashOp::Count) == std::variant_size_v<SquashFunc>,
+              "SquashOp out of sync with SquashFunc.");
 } // namespace Nevolver
 
 #endif /* SQUASH_H */
@@ -0,0 +1,398 @@
+#include "../network.hpp"
+#include "../networks/liquid.hpp"
+#include "../networks/lstm.hpp"
+#include "../networks/mlp.hpp"
+#include "../networks/narx.hpp"
+#include "../trainer.hpp"
+
+#define CATCH_CONFIG_MAIN
+#define CATCH_CONFIG_ENABLE_BENCHMARKING
+#include <catch2/catch.hpp>
+
+INITIALIZE_EASYLOGGINGPP
+
+#ifdef NEVOLVER_WIDE
+// what NeuroFloat math used to be, one double precision library call per lane
+template <typename F> static NeuroFloat lanes(const NeuroFloat &x, F f) {
+  NeuroFloat res;
+  for (auto i = 0; i < NeuroFloat::Width; i++) {
+    res.vec[i] = f(x.vec[i]);
+  }
+  return res;
+}
+
+template <typename V, typename S>
+static void benchWideMath(const std::string &name, V vectorized, S scalar,
+                          float lo, float hi) {
+  std::vector<NeuroFloat> inputs(1024);
+  for (size_t i = 0; i < inputs.size(); i++) {
+    for (auto l = 0; l < NeuroFloat::Width; l++) {
+      inputs[i].vec[l] =
+          lo + (hi - lo) * Nevolver::Random::nextDouble();
+    }
+  }
+
+  BENCHMARK(std::string(name)) {
+    NeuroFloat acc(0.0);
+    for (auto &x : inputs) {
+      acc += vectorized(x);
+    }
+    return acc;
+  };
+
+  BENCHMARK(name + " lanes") {
+    NeuroFloat acc(0.0);
+    for (auto &x : inputs) {
+      acc += lanes(x, scalar);
+    }
+    return acc;
+  };
+}
+
+TEST_CASE("Wide math", "[wmath]") {
+  benchWideMath(
+      "exp", [](auto x) { return vexp(x); },
+      [](float x) { return __builtin_exp(x); }, -10.0, 10.0);
+  benchWideMath(
+      "log", [](auto x) { return vlog(x); },
+      [](float x) { return __builtin_log(x); }, 0.001, 1000.0);
+  benchWideMath(
+      "sin", [](auto x) { return vsin(x); },
+      [](float x) { return __builtin_sin(x); }, -10.0, 10.0);
+  benchWideMath(
+      "cos", [](auto x) { return vcos(x); },
+      [](float x) { return __builtin_cos(x); }, -10.0, 10.0);
+  benchWideMath(
+      "tanh", [](auto x) { return vtanh(x); },
+      [](float x) { return __builtin_tanh(x); }, -5.0, 5.0);
+  benchWideMath(
+      "sqrt", [](auto x) { return vsqrt(x); },
+      [](float x) { return __builtin_sqrt(x); }, 0.0, 100.0);
+  benchWideMath(
+      "pow", [](auto x) { return vpow(x, 0.3); },
+      [](float x) { return __builtin_pow(x, 0.3); }, 0.01, 100.0);
+  benchWideMath(
+      "pow2", [](auto x) { return vpow(x, 2.0); },
+      [](float x) { return __builtin_pow(x, 2.0); }, -10.0, 10.0);
+}
+#endif
+
+#ifndef NEVOLVER_WIDE
+// big enough for weights to fall out of cache
+TEST_CASE("Quantized inference", "[quantized]") {
+  auto mlp = Nevolver::MLP(256, {1024, 1024}, 8);
+  std::vector<std::vector<NeuroFloat>> inputs(64);
+  for (auto &input : inputs) {
+    for (auto i = 0; i < 256; i++) {
+      input.emplace_back(Nevolver::Random::nextDouble());
+    }
+  }
+
+  mlp.freeze();
+  auto quantized = mlp.quantize(inputs);
+  auto report = mlp.compare(quantized, inputs);
+  WARN("max error " << report.maxError << ", rms error " << report.rmsError
+                    << ", " << quantized.weightBytes() << " weight bytes");
+
+  std::vector<NeuroFloat> output;
+  BENCHMARK("float") {
+    for (auto &input : inputs) {
+      mlp.activateFast(input, output);
+    }
+    return output[0];
+  };
+
+  BENCHMARK("int8") {
+    for (auto &input : inputs) {
+      quantized.activate(input, output);
+    }
+    return output[0];
+  };
+}
+#endif
+
+TEST_CASE("Dense layers", "[dense]") {
+  auto mlp = Nevolver::MLP(16, {128, 128, 128}, 4);
+  std::vector<float> inputs(64 * 16), outputs(64 * 4);
+  for (auto &v : inputs) {
+    v = float(Nevolver::Random::nextDouble());
+  }
+  std::vector<NeuroFloat> input(inputs.begin(), inputs.begin() + 16);
+
+  std::vector<NeuroFloat> output;
+  BENCHMARK("3x128 nodes") {
+    mlp.activateFast(input, output);
+    return output[0];
+  };
+
+  mlp.freeze();
+  WARN(mlp.frozenPlan().denseBlocks() << " dense blocks");
+  BENCHMARK("3x128 plan") {
+    mlp.activateFast(input, output);
+    return output[0];
+  };
+
+  BENCHMARK("3x128 batch of 64") {
+    mlp.activateBatchFeedforward(inputs.data(), 64, 16, outputs.data());
+    return outputs[0];
+  };
+}
+
+static void benchSparse(const std::string &shape, size_t fanIn) {
+  for (size_t connections : {1000, 10000, 100000}) {
+    const auto hidden = uint32_t(connections / fanIn);
+    Nevolver::Liquid net(16, hidden, 4, connections);
+    std::vector<std::vector<NeuroFloat>> inputs(16);
+    for (auto &input : inputs) {
+      for (auto i = 0; i < 16; i++) {
+        input.emplace_back(Nevolver::Random::nextDouble());
+      }
+    }
+
+    std::vector<NeuroFloat> output;
+    const auto name =
+        shape + " " + std::to_string(connections) + " connections";
+    BENCHMARK(name + " nodes") {
+      for (auto &input : inputs) {
+        net.activateFast(input, output);
+      }
+      return output[0];
+    };
+
+    net.freeze();
+    WARN(name << (net.frozenPlan().sparse() ? ": slices" : ": CSR"));
+    BENCHMARK(name + " plan") {
+      for (auto &input : inputs) {
+        net.activateFast(input, output);
+      }
+      return output[0];
+    };
+    net.unfreeze();
+  }
+}
+
+TEST_CASE("Sparse activation", "[sparse]") {
+  // long dependency chains end up as CSR, shallow ones as slices
+  benchSparse("deep", 20);
+  benchSparse("wide", 4);
+}
+
+TEST_CASE("Connection mutations", "[mutation]") {
+  // pairs with removals so that the density stays the same
+  std::vector<Nevolver::NetworkMutations> fwd, bwd;
+  for (auto i = 0; i < 50; i++) {
+    fwd.emplace_back(Nevolver::NetworkMutations::AddFwdConnection);
+    fwd.emplace_back(Nevolver::NetworkMutations::SubConnection);
+    bwd.emplace_back(Nevolver::NetworkMutations::AddBwdConnection);
+    bwd.emplace_back(Nevolver::NetworkMutations::SubConnection);
+  }
+
+  for (uint32_t hidden : {100, 1000, 10000}) {
+    Nevolver::Liquid net(16, hidden, 4, hidden * 10);
+    const auto name = std::to_string(hidden) + " nodes";
+    BENCHMARK(name + " 50 AddFwdConnection") {
+      net.mutate(fwd, 1.0, {}, 0.0, 0.0);
+    };
+    BENCHMARK(name + " 50 AddBwdConnection") {
+      net.mutate(bwd, 1.0, {}, 0.0, 0.0);
+    };
+  }
+}
+
+TEST_CASE("Compaction", "[compact]") {
+  // churn scatters live nodes and connections over recycled slots
+  Nevolver::Liquid net(16, 10000, 4, 100000);
+  net.setAutoCompact(false);
+  std::vector<Nevolver::NetworkMutations> churn;
+  for (auto i = 0; i < 5000; i++) {
+    churn.emplace_back(Nevolver::NetworkMutations::SubNode);
+    churn.emplace_back(Nevolver::NetworkMutations::AddNode);
+    churn.emplace_back(Nevolver::NetworkMutations::SubConnection);
+    churn.emplace_back(Nevolver::NetworkMutations::AddFwdConnection);
+  }
+  for (auto i = 0; i < 4; i++) {
+    net.mutate(churn, 1.0, {}, 0.0, 0.0);
+  }
+
+  std::vector<NeuroFloat> input(16, 0.5);
+  std::vector<NeuroFloat> output;
+  BENCHMARK("scattered") {
+    net.activateFast(input, output);
+    return output[0];
+  };
+
+  BENCHMARK("copy and compact") {
+    Nevolver::Network copy = net;
+    copy.compact();
+    return copy.getStats().activeNodes;
+  };
+
+  net.compact();
+  BENCHMARK("compacted") {
+    net.activateFast(input, output);
+    return output[0];
+  };
+}
+
+TEST_CASE("Cloning", "[clone]") {
+  Nevolver::Liquid net(16, 5000, 4, 100000);
+  std::vector<NeuroFloat> output;
+  net.activate(std::vector<NeuroFloat>(16, 0.5), output);
+  net.propagate(std::vector<NeuroFloat>(4, 1.0));
+
+  BENCHMARK("serialize round trip") {
+    std::stringstream ss;
+    {
+      cereal::BinaryOutputArchive oa(ss);
+      oa(net);
+    }
+    Nevolver::Network copy;
+    cereal::BinaryInputArchive ia(ss);
+    ia(copy);
+    return copy.getStats().activeNodes;
+  };
+
+  BENCHMARK("clone") { return net.clone().getStats().activeNodes; };
+
+  BENCHMARK("clone without traces") {
+    return net.clone(false).getStats().activeNodes;
+  };
+}
+
+TEST_CASE("Mutation rates", "[rates]") {
+  Nevolver::Liquid net(16, 5000, 4, 100000);
+  const std::vector<Nevolver::NodeMutations> nodeMuts{
+      Nevolver::NodeMutations::Squash, Nevolver::NodeMutations::Bias};
+  for (auto rate : {0.001, 0.01, 0.1}) {
+    BENCHMARK("rate " + std::to_string(rate)) {
+      net.mutate({}, 0.0, nodeMuts, rate, rate);
+    };
+    BENCHMARK("weights only, rate " + std::to_string(rate)) {
+      net.mutate({}, 0.0, {}, 0.0, rate);
+    };
+  }
+}
+
+TEST_CASE("Data parallel training", "[trainer]") {
+  std::vector<std::vector<NeuroFloat>> inputs(64), targets(64);
+  for (size_t i = 0; i < inputs.size(); i++) {
+    for (auto j = 0; j < 16; j++) {
+      inputs[i].emplace_back(Nevolver::Random::nextDouble());
+    }
+    for (auto j = 0; j < 4; j++) {
+      targets[i].emplace_back(Nevolver::Random::nextDouble());
+    }
+  }
+
+  auto bench = [&](const std::string &name, Nevolver::Network &net) {
+    BENCHMARK(name + " serial") {
+      for (size_t i = 0; i < inputs.size(); i++) {
+        net.activate(inputs[i]);
+        net.propagate(targets[i], 0.0, 0.0, false);
+      }
+      net.applyGradients(0.1);
+    };
+
+    for (size_t workers = 1; workers <= std::thread::hardware_concurrency();
+         workers *= 2) {
+      Nevolver::Trainer trainer(net, workers);
+      BENCHMARK(name + " " + std::to_string(workers) + " workers") {
+        return trainer.train(inputs, targets, 0.1);
+      };
+    }
+  };
+
+  auto mlp = Nevolver::MLP(16, {64, 64}, 4);
+  bench("mlp", mlp);
+  auto narx = Nevolver::NARX(16, {64, 64}, 4, 4, 4);
+  bench("narx", narx);
+}
+
+TEST_CASE("Optimizers", "[optimizers]") {
+  const std::vector<std::pair<std::string, Nevolver::Optimizer>> kinds{
+      {"sgd", Nevolver::Optimizer::SGD},
+      {"nesterov", Nevolver::Optimizer::Nesterov},
+      {"rmsprop", Nevolver::Optimizer::RMSProp},
+      {"adam", Nevolver::Optimizer::Adam}};
+
+  // epochs to learn or, mini-batches of the whole truth table
+  const std::vector<std::vector<NeuroFloat>> truth{
+      {0.0, 0.0}, {0.0, 1.0}, {1.0, 0.0}, {1.0, 1.0}};
+  const std::vector<NeuroFloat> ors{0.0, 1.0, 1.0, 1.0};
+  const std::vector<double> rates{1.0, 1.0, 0.01, 0.05};
+  const std::vector<double> momenta{0.9, 0.9, 0.0, 0.9};
+  for (size_t k = 0; k < kinds.size(); k++) {
+    size_t epochs = 0;
+    for (auto run = 0; run < 20; run++) {
+      auto mlp = Nevolver::MLP(2, {4, 4}, 1);
+      mlp.setOptimizer(kinds[k].second);
+      for (auto epoch = 0; epoch < 5000; epoch++, epochs++) {
+        NeuroFloat error(0);
+        for (size_t i = 0; i < truth.size(); i++) {
+          mlp.activate(truth[i]);
+          error += mlp.propagate({ors[i]}, 0.0, 0.0, false);
+        }
+        mlp.applyGradients(rates[k], momenta[k]);
+        if (mean(error) < 0.004)
+          break;
+      }
+    }
+    WARN(kinds[k].first << " " << epochs / 20 << " epochs");
+  }
+
+  auto mlp = Nevolver::MLP(64, {256, 256}, 8);
+  std::vector<NeuroFloat> input(64, 0.5), target(8, 0.5);
+  for (auto &[name, kind] : kinds) {
+    mlp.setOptimizer(kind);
+    BENCHMARK(name + " sample and update") {
+      mlp.activate(input);
+      mlp.propagate(target, 0.0, 0.0, false);
+      mlp.applyGradients(0.001, 0.9);
+    };
+  }
+}
+
+TEST_CASE("Plain backprop", "[plain]") {
+  // the loop of the MLP SGD test
+  const std::vector<std::vector<NeuroFloat>> truth{
+      {0.0, 0.0}, {0.0, 1.0}, {1.0, 0.0}, {1.0, 1.0}};
+  const std::vector<std::vector<NeuroFloat>> xnor{{1.0}, {0.0}, {0.0}, {1.0}};
+  auto small = Nevolver::MLP(2, {4, 4}, 1);
+  auto traced = small;
+  traced.setPlainPaths(false);
+  for (auto net : {&small, &traced}) {
+    BENCHMARK(std::string(net->plain() ? "plain" : "traced") +
+              " 2-4-4-1, 1000 epochs") {
+      for (auto epoch = 0; epoch < 1000; epoch++) {
+        for (size_t i = 0; i < truth.size(); i++) {
+          net->activate(truth[i]);
+          net->propagate(xnor[i]);
+        }
+      }
+    };
+  }
+
+  auto big = Nevolver::MLP(16, {64, 64}, 4);
+  auto bigTraced = big;
+  bigTraced.setPlainPaths(false);
+  std::vector<NeuroFloat> input(16, 0.5), target(4, 0.5);
+  for (auto net : {&big, &bigTraced}) {
+    BENCHMARK(std::string(net->plain() ? "plain" : "traced") +
+              " 16-64-64-4 sample") {
+      net->activate(input);
+      return net->propagate(target);
+    };
+  }
+}
+
+TEST_CASE("Gated backprop", "[xtraces]") {
+  std::vector<NeuroFloat> input(4, 0.5), target(2, 0.5);
+  for (auto blocks : {4, 16}) {
+    auto lstm = Nevolver::LSTM(4, {blocks, blocks}, 2);
+    BENCHMARK("LSTM 4-" + std::to_string(blocks) + "-" +
+              std::to_string(blocks) + "-2 sample") {
+      lstm.activate(input);
+      return lstm.propagate(target, 0.1);
+    };
+  }
+}
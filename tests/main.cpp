@@ -1,9 +1,16 @@
 #include "../network.hpp"
+#include "../networks/liquid.hpp"
 #include "../networks/lstm.hpp"
 #include "../networks/mlp.hpp"
 #include "../networks/narx.hpp"
+#include "../trainer.hpp"
+#include <cfloat>
+#include <cstdlib>
+#include <filesystem>
 #include <fstream>
 #include <iostream>
+#include <set>
+#include <sstream>
 
 #define CATCH_CONFIG_MAIN
 #include <catch2/catch.hpp>
@@ -68,9 +75,9 @@ TEST_CASE("MLP test vectors", "[perceptronv]") {
   for (auto &w : perceptron.weights()) {
     w.first = 0.3;
   }
-  for (auto &n : perceptron.nodes()) {
+  for (auto n : perceptron.nodes()) {
     try {
-      auto &node = n.get();
+      auto &node = perceptron.node(n);
       auto &hn = std::get<Nevolver::HiddenNode>(node);
       // hn.setSquash(Nevolver::IdentityS(), Nevolver::IdentityD());
       hn.setBias(0.2);
@@ -101,9 +108,9 @@ TEST_CASE("NARX test vectors", "[narxv]") {
   for (auto &w : narx.weights()) {
     w.first = 0.3;
   }
-  for (auto &n : narx.nodes()) {
+  for (auto n : narx.nodes()) {
     try {
-      auto &node = n.get();
+      auto &node = narx.node(n);
       auto &hn = std::get<Nevolver::HiddenNode>(node);
       // hn.setSquash(Nevolver::IdentityS(), Nevolver::IdentityD());
       hn.setBias(0.2);
@@ -126,9 +133,9 @@ TEST_CASE("LSTM test vectors", "[lstmv]") {
   for (auto &w : lstm.weights()) {
     w.first = 0.3;
   }
-  for (auto &n : lstm.nodes()) {
+  for (auto n : lstm.nodes()) {
     try {
-      auto &node = n.get();
+      auto &node = lstm.node(n);
       auto &hn = std::get<Nevolver::HiddenNode>(node);
       hn.setBias(0.2);
     } catch (...) {
@@ -453,3 +460,1175 @@ TEST_CASE("Squash", "[squash]") {
     REQUIRE(d(-0.77, fwd) == MyApprox(0.814023));
   }
 }
+
+static bool sameBits(const NeuroFloat &a, const NeuroFloat &b) {
+  return std::memcmp(&a, &b, sizeof(NeuroFloat)) == 0;
+}
+
+TEST_CASE("Fused squash", "[squash]") {
+  for (size_t op = 0; op < Nevolver::Squash::SFuncs.size(); op++) {
+    for (auto x : {-2.3, -0.77, -0.1, 0.0, 0.3, 0.77, 1.5, 4.0}) {
+      NeuroFloat input = x;
+      auto fwd = std::visit([&](auto &&f) { return f(input); },
+                            Nevolver::Squash::SFuncs[op]);
+      auto derivative =
+          std::visit([&](auto &&f) { return f(input, fwd); },
+                     Nevolver::Squash::DFuncs[op]);
+
+      NeuroFloat fusedDerivative;
+      auto fused = Nevolver::Squash::activate(Nevolver::SquashOp(op), input,
+                                              fusedDerivative);
+      REQUIRE(sameBits(fused, fwd));
+      REQUIRE(sameBits(fusedDerivative, derivative));
+      REQUIRE(sameBits(
+          Nevolver::Squash::activate(Nevolver::SquashOp(op), input), fwd));
+    }
+  }
+}
+
+#ifdef NEVOLVER_WIDE
+template <typename F, typename R>
+static void checkWideMath(F f, R ref, float lo, float hi, double ulps,
+                          double absolute = 0.0) {
+  const int n = 100000;
+  double worst = 0.0; // error over tolerance
+  for (int i = 0; i < n; i += NeuroFloat::Width) {
+    NeuroFloat x;
+    for (auto l = 0; l < NeuroFloat::Width; l++) {
+      x.vec[l] = lo + (hi - lo) * (double(i + l) / n);
+    }
+    auto y = f(x);
+    for (auto l = 0; l < NeuroFloat::Width; l++) {
+      auto expected = ref(double(x.vec[l]));
+      auto tolerance = std::max(absolute, std::fabs(expected) * ulps *
+                                              FLT_EPSILON);
+      worst = std::max(worst, std::fabs(y.vec[l] - expected) / tolerance);
+    }
+  }
+  REQUIRE(worst <= 1.0);
+}
+
+TEST_CASE("Wide math", "[wmath]") {
+  checkWideMath([](auto x) { return vexp(x); },
+                [](double x) { return std::exp(x); }, -87.0, 88.0, 1.0);
+  checkWideMath([](auto x) { return vlog(x); },
+                [](double x) { return std::log(x); }, 1e-30, 1e6, 1.0);
+  checkWideMath([](auto x) { return vsin(x); },
+                [](double x) { return std::sin(x); }, -10.0, 10.0, 1.0,
+                1e-7);
+  checkWideMath([](auto x) { return vcos(x); },
+                [](double x) { return std::cos(x); }, -8192.0, 8192.0, 1.0,
+                1e-7);
+  checkWideMath([](auto x) { return vtanh(x); },
+                [](double x) { return std::tanh(x); }, -10.0, 10.0, 2.0);
+  checkWideMath([](auto x) { return vsqrt(x); },
+                [](double x) { return std::sqrt(x); }, 0.0, 100.0, 3.0);
+  checkWideMath([](auto x) { return vpow(x, 2.0); },
+                [](double x) { return x * x; }, -100.0, 100.0, 0.5);
+  checkWideMath([](auto x) { return vpow(x, 0.3); },
+                [](double x) { return std::pow(x, 0.3); }, 0.01, 100.0, 3.0);
+}
+#endif
+
+// The presets plans, batches, exports, quantization and weight storage are
+// checked on, along with inputs for them.
+struct Presets {
+  Nevolver::MLP mlp{2, {8, 4}, 1};
+  Nevolver::NARX narx{2, {4, 3}, 1, 3, 3};
+  Nevolver::LSTM lstm{2, {4, 2}, 1};
+
+  const std::vector<std::vector<NeuroFloat>> inputs{
+      {1.0, 0.0}, {0.0, 0.0}, {0.0, 1.0}, {1.0, 1.0},
+      {0.3, 0.7}, {0.9, 0.1}, {0.5, 0.5}, {0.2, 0.8}};
+
+  std::vector<Nevolver::Network *> all() { return {&mlp, &narx, &lstm}; }
+};
+
+static void checkFrozen(Nevolver::Network &net,
+                        const std::vector<std::vector<NeuroFloat>> &inputs) {
+  net.unfreeze();
+  net.clear();
+  std::vector<NeuroFloat> expected;
+  for (auto &input : inputs) {
+    for (auto &v : net.activateFast(input)) {
+      expected.push_back(v);
+    }
+  }
+
+  net.clear();
+  net.freeze();
+  std::vector<NeuroFloat> results;
+  for (auto &input : inputs) {
+    for (auto &v : net.activateFast(input)) {
+      results.push_back(v);
+    }
+  }
+
+  REQUIRE(results.size() == expected.size());
+  for (size_t i = 0; i < results.size(); i++) {
+    REQUIRE(sameBits(results[i], expected[i]));
+  }
+
+  // state must survive going back and forth
+  net.clear();
+  results.clear();
+  auto half = inputs.size() / 2;
+  for (size_t i = 0; i < inputs.size(); i++) {
+    if (i == half)
+      net.unfreeze();
+    for (auto &v : net.activateFast(inputs[i])) {
+      results.push_back(v);
+    }
+  }
+
+  REQUIRE(results.size() == expected.size());
+  for (size_t i = 0; i < results.size(); i++) {
+    REQUIRE(sameBits(results[i], expected[i]));
+  }
+}
+
+// h0 gates the self connection of o, all three read both inputs
+struct SelfGated : Nevolver::Network {
+  SelfGated() {
+    Nevolver::Group inputs, hidden;
+    for (auto i = 0; i < 2; i++) {
+      auto node = addNode(Nevolver::InputNode());
+      _sortedNodes.emplace_back(node);
+      _inputs.emplace_back(node);
+      inputs.emplace_back(node);
+    }
+    for (auto i = 0; i < 3; i++) {
+      auto node = addNode(Nevolver::HiddenNode(i == 2));
+      _sortedNodes.emplace_back(node);
+      hidden.emplace_back(node);
+    }
+    _outputs.emplace_back(hidden[2]);
+
+    connect(inputs, hidden, Nevolver::ConnectionPattern::AllToAll);
+    auto self = connect(hidden[2], hidden[2]);
+    gate(hidden[0], self);
+    for (uint32_t conn = 0; conn < _connections.size(); conn++) {
+      addWeight(conn, Nevolver::Random::init());
+    }
+  }
+};
+
+TEST_CASE("Frozen activation plan", "[plan]") {
+  Presets presets;
+  auto &[mlp, narx, lstm, inputs] = presets;
+  for (auto net : presets.all()) {
+    checkFrozen(*net, inputs);
+
+    // one plan node per network node, inbound connections in ranges
+    // and self ones on their own
+    net->freeze();
+    auto &plan = net->frozenPlan();
+    REQUIRE(plan.size() == net->nodes().size());
+    size_t inbound = 0;
+    for (auto &conn : net->connections()) {
+      if (conn.active != Nevolver::NoIndex && conn.from != conn.to)
+        inbound++;
+    }
+    REQUIRE(plan.connections() == inbound);
+  }
+  // only the mlp has no state to carry over
+  REQUIRE(mlp.frozenPlan().feedforward());
+  REQUIRE(!narx.frozenPlan().feedforward());
+  REQUIRE(!lstm.frozenPlan().feedforward());
+
+  // fully connected layers run as dense blocks
+  auto layered = Nevolver::MLP(2, {128, 128, 128}, 1);
+  checkFrozen(layered, inputs);
+  auto nets = presets.all();
+  nets.emplace_back(&layered);
+  for (auto net : nets) {
+    net->freeze();
+    REQUIRE(net->frozenPlan().denseBlocks() > 0);
+    REQUIRE(!net->frozenPlan().sparse());
+  }
+  // one block per hidden layer, a single output node is no matrix
+  REQUIRE(layered.frozenPlan().denseBlocks() == 3);
+  REQUIRE_THROWS_AS(Nevolver::Network().frozenPlan(), std::runtime_error);
+
+  // weights edits must be picked up
+  for (auto &w : mlp.weights()) {
+    w.first = 0.3;
+  }
+  checkFrozen(mlp, inputs);
+
+  // so must be topology edits
+  const std::vector<Nevolver::NetworkMutations> muts{
+      Nevolver::NetworkMutations::AddNode,
+      Nevolver::NetworkMutations::SubNode,
+      Nevolver::NetworkMutations::AddFwdConnection,
+      Nevolver::NetworkMutations::AddBwdConnection,
+      Nevolver::NetworkMutations::SubConnection,
+      Nevolver::NetworkMutations::ShareWeight,
+      Nevolver::NetworkMutations::SwapNodes,
+      Nevolver::NetworkMutations::AddGate,
+      Nevolver::NetworkMutations::SubGate};
+  const std::vector<Nevolver::NodeMutations> nmuts{
+      Nevolver::NodeMutations::Squash, Nevolver::NodeMutations::Bias};
+  for (auto i = 0; i < 10; i++) {
+    lstm.mutate(muts, 0.5, nmuts, 0.2, 0.2);
+    checkFrozen(lstm, inputs);
+  }
+
+  // AddGate can gate a self connection from an earlier row of the same
+  // block, that row must be finished first so o stays out of the block
+  SelfGated gated;
+  checkFrozen(gated, inputs);
+  gated.freeze();
+  REQUIRE(gated.frozenPlan().denseBlocks() == 1);
+
+  // evolved sparse topologies
+  for (auto i = 0; i < 20; i++) {
+    auto liquid = Nevolver::Liquid(2, 30, 1);
+    for (auto j = 0; j < 5; j++) {
+      liquid.mutate(muts, 0.9, nmuts, 0.2, 0.2);
+    }
+    checkFrozen(liquid, inputs);
+  }
+  for (auto i = 0; i < 3; i++) {
+    auto liquid = Nevolver::Liquid(2, 500, 2, 2500);
+    checkFrozen(liquid, inputs);
+  }
+
+  // wide and shallow ones run as slices
+  auto wide = Nevolver::Liquid(16, 1000, 4, 2000);
+  std::vector<std::vector<NeuroFloat>> wideInputs(8);
+  for (auto &input : wideInputs) {
+    for (auto i = 0; i < 16; i++) {
+      input.emplace_back(Nevolver::Random::nextDouble());
+    }
+  }
+  checkFrozen(wide, wideInputs);
+  wide.freeze();
+  REQUIRE(wide.frozenPlan().sparse());
+  REQUIRE(wide.frozenPlan().denseBlocks() == 0);
+  wide.clear();
+  std::vector<NeuroFloat> sliced;
+  for (auto &input : wideInputs) {
+    for (auto &v : wide.activateFast(input)) {
+      sliced.push_back(v);
+    }
+  }
+  wide.unfreeze();
+  wide.clear();
+  size_t k = 0;
+  for (auto &input : wideInputs) {
+    for (auto &v : wide.activate(input)) {
+      REQUIRE(sameBits(v, sliced[k++]));
+    }
+  }
+  REQUIRE(k == sliced.size());
+
+  // and loading
+  {
+    std::stringstream ss;
+    cereal::BinaryOutputArchive oa(ss);
+    oa(lstm);
+    Nevolver::Network loaded;
+    loaded.freeze();
+    cereal::BinaryInputArchive ia(ss);
+    ia(loaded);
+    checkFrozen(loaded, inputs);
+  }
+}
+
+static void checkBatch(Nevolver::Network &net, size_t ninputs, size_t n) {
+  // padded rows, to exercise stride
+  const size_t stride = ninputs + 1;
+  std::vector<float> inputs(n * stride);
+  for (auto &v : inputs) {
+    v = float(Nevolver::Random::nextDouble());
+  }
+
+  net.clear();
+  std::vector<float> expected;
+  std::vector<NeuroFloat> input(ninputs);
+  for (size_t s = 0; s < n; s++) {
+    for (size_t i = 0; i < ninputs; i++) {
+      input[i] = inputs[s * stride + i];
+    }
+    for (auto &v : net.activateFast(input)) {
+      expected.push_back(mean(v));
+    }
+  }
+  auto last = net.activateFast(input);
+
+  // batched squash loops might use vectorized math, so not bit exact
+  net.clear();
+  std::vector<float> outputs(expected.size());
+  net.activateBatch(inputs.data(), n, stride, outputs.data());
+  for (size_t i = 0; i < outputs.size(); i++) {
+    REQUIRE(outputs[i] == Approx(expected[i]));
+  }
+
+  // and the state must carry on
+  auto next = net.activateFast(input);
+  REQUIRE(next.size() == last.size());
+  for (size_t i = 0; i < next.size(); i++) {
+    REQUIRE(next[i] == MyApprox(last[i]));
+  }
+
+  // every sample on its own
+  expected.clear();
+  for (size_t s = 0; s < n; s++) {
+    for (size_t i = 0; i < ninputs; i++) {
+      input[i] = inputs[s * stride + i];
+    }
+    net.clear();
+    for (auto &v : net.activateFast(input)) {
+      expected.push_back(mean(v));
+    }
+  }
+
+  net.clear();
+  net.activateBatchFeedforward(inputs.data(), n, stride, outputs.data());
+  for (size_t i = 0; i < outputs.size(); i++) {
+    REQUIRE(outputs[i] == Approx(expected[i]));
+  }
+
+  // samples are lanes of their own, changing one leaves every other row
+  // exactly as it was
+  const auto changedSample = n / 2;
+  auto changed = inputs;
+  for (size_t i = 0; i < ninputs; i++) {
+    auto &v = changed[changedSample * stride + i];
+    v = 1.0f - v;
+  }
+  const auto noutputs = outputs.size() / n;
+  std::vector<float> again(outputs.size());
+  net.clear();
+  net.activateBatchFeedforward(changed.data(), n, stride, again.data());
+  for (size_t s = 0; s < n; s++) {
+    for (size_t o = 0; o < noutputs && s != changedSample; o++) {
+      REQUIRE(again[s * noutputs + o] == outputs[s * noutputs + o]);
+    }
+  }
+
+  // while state only flows forward, rows before the change stay
+  net.clear();
+  net.activateBatch(inputs.data(), n, stride, outputs.data());
+  net.clear();
+  net.activateBatch(changed.data(), n, stride, again.data());
+  for (size_t i = 0; i < changedSample * noutputs; i++) {
+    REQUIRE(again[i] == outputs[i]);
+  }
+}
+
+TEST_CASE("Batched activation", "[batch]") {
+  Presets presets;
+  const auto ninputs = presets.inputs[0].size();
+  checkBatch(presets.mlp, ninputs, 150);
+
+  // unfrozen networks keep no plan, batches see weights edited through a
+  // reference held from before
+  auto &mlp = presets.mlp;
+  auto &weights = mlp.weights();
+  const std::vector<float> row{1.0f, 0.0f};
+  float before, after;
+  mlp.clear();
+  mlp.activateBatch(row.data(), 1, ninputs, &before);
+  for (size_t i = 0; i < weights.size(); i++) {
+    weights.mut(i).first = weights[i].first * 2.0;
+  }
+  mlp.clear();
+  mlp.activateBatch(row.data(), 1, ninputs, &after);
+  REQUIRE(after != before);
+  mlp.clear();
+  REQUIRE(after == Approx(mean(mlp.activateFast(presets.inputs[0])[0])));
+
+  presets.mlp.freeze();
+  checkBatch(presets.mlp, ninputs, 1);
+  checkBatch(presets.lstm, ninputs, 150);
+  checkBatch(presets.narx, ninputs, 70);
+}
+
+#if !defined(NEVOLVER_WIDE) && defined(NEVOLVER_CC)
+static void checkExport(Nevolver::Network &net,
+                        const std::vector<std::vector<NeuroFloat>> &inputs,
+                        const std::string &name) {
+  const auto dir = std::filesystem::temp_directory_path();
+  const auto source = dir / (name + ".c");
+  const auto library = dir / (name + ".so");
+
+  // exported mid sequence, the source starts from the current state
+  net.clear();
+  net.activateFast(inputs[0]);
+  {
+    std::ofstream os(source);
+    net.exportSource(os, name);
+  }
+
+  const auto cmd = std::string(NEVOLVER_CC) + " -O2 -shared -fPIC " +
+                   source.string() + " -o " + library.string() + " -lm";
+  REQUIRE(std::system(cmd.c_str()) == 0);
+
+  Nevolver::CompiledNetwork compiled(library.string(), name);
+  REQUIRE(compiled.inputs() == inputs[0].size());
+
+  // constants are written exactly, only libm may differ
+  std::vector<NeuroFloat> expected, outputs, first;
+  for (auto i = 0; i < 3; i++) {
+    for (auto &input : inputs) {
+      net.activateFast(input, expected);
+      compiled.activate(input, outputs);
+      REQUIRE(outputs.size() == expected.size());
+      REQUIRE(compiled.outputs() == expected.size());
+      for (size_t o = 0; o < outputs.size(); o++) {
+        REQUIRE(outputs[o] == Approx(expected[o]).margin(1e-6));
+      }
+      if (i == 0)
+        first.insert(first.end(), outputs.begin(), outputs.end());
+    }
+  }
+
+  // reset goes back to the exported state
+  compiled.reset();
+  size_t k = 0;
+  for (auto &input : inputs) {
+    compiled.activate(input, outputs);
+    for (auto &v : outputs) {
+      REQUIRE(v == first[k++]);
+    }
+  }
+
+  std::vector<NeuroFloat> wrong(inputs[0].size() + 1, 0.0);
+  REQUIRE_THROWS_AS(compiled.activate(wrong, outputs), std::runtime_error);
+}
+
+TEST_CASE("Exported source", "[codegen]") {
+  Presets presets;
+  checkExport(presets.mlp, presets.inputs, "nevolver_mlp");
+  checkExport(presets.narx, presets.inputs, "nevolver_narx");
+  checkExport(presets.lstm, presets.inputs, "nevolver_lstm");
+
+  // squashes and gates moved around
+  const std::vector<Nevolver::NetworkMutations> muts{
+      Nevolver::NetworkMutations::AddFwdConnection,
+      Nevolver::NetworkMutations::AddBwdConnection,
+      Nevolver::NetworkMutations::AddGate, Nevolver::NetworkMutations::SubGate};
+  const std::vector<Nevolver::NodeMutations> nmuts{
+      Nevolver::NodeMutations::Squash, Nevolver::NodeMutations::Bias};
+  for (auto i = 0; i < 10; i++) {
+    presets.lstm.mutate(muts, 0.5, nmuts, 0.5, 0.2);
+  }
+  checkExport(presets.lstm, presets.inputs, "nevolver_lstm_mutated");
+}
+#endif
+
+#ifndef NEVOLVER_WIDE
+static void checkQuantized(Nevolver::Network &net,
+                           const std::vector<std::vector<NeuroFloat>> &inputs,
+                           double maxError) {
+  net.freeze();
+  auto quantized = net.quantize(inputs);
+  REQUIRE(quantized.inputs() == inputs[0].size());
+  REQUIRE(quantized.outputs() == 1);
+  // int8 weights, at most a quarter of the float plan
+  REQUIRE(quantized.weightBytes() > 0);
+  REQUIRE(quantized.weightBytes() * sizeof(float) <=
+          net.frozenPlan().weightBytes());
+
+  // unseen inputs from the calibrated range
+  std::vector<std::vector<NeuroFloat>> unseen(32);
+  for (auto &input : unseen) {
+    for (size_t i = 0; i < inputs[0].size(); i++) {
+      input.emplace_back(Nevolver::Random::nextDouble());
+    }
+  }
+
+  auto report = net.compare(quantized, unseen);
+  REQUIRE(report.samples == unseen.size());
+  REQUIRE(report.maxErrors.size() == quantized.outputs());
+  for (auto error : report.maxErrors) {
+    REQUIRE(error <= report.maxError);
+  }
+  REQUIRE(report.meanError <= report.maxError);
+  REQUIRE(report.rmsError <= report.maxError);
+  // actually rounded, yet within the bound
+  REQUIRE(report.maxError > 0.0);
+  REQUIRE(report.maxError < maxError);
+  net.unfreeze();
+}
+
+TEST_CASE("Quantized inference", "[quantized]") {
+  Presets presets;
+  for (auto net : presets.all()) {
+    checkQuantized(*net, presets.inputs, 0.01);
+  }
+
+  SECTION("Non finite inputs") {
+    auto &mlp = presets.mlp;
+    auto quantized = mlp.quantize(presets.inputs);
+    std::vector<NeuroFloat> expected, actual;
+
+    // NaN reads as 0, infinities saturate
+    const auto nan = std::numeric_limits<float>::quiet_NaN();
+    const auto inf = std::numeric_limits<float>::infinity();
+    quantized.activate(std::vector<NeuroFloat>{0.0, 0.5}, expected);
+    quantized.activate(std::vector<NeuroFloat>{nan, 0.5}, actual);
+    REQUIRE(actual == expected);
+
+    quantized.activate(std::vector<NeuroFloat>{1e30, 0.5}, expected);
+    quantized.activate(std::vector<NeuroFloat>{inf, 0.5}, actual);
+    REQUIRE(actual == expected);
+    quantized.activate(std::vector<NeuroFloat>{-1e30, 0.5}, expected);
+    quantized.activate(std::vector<NeuroFloat>{-inf, 0.5}, actual);
+    REQUIRE(actual == expected);
+  }
+}
+#endif
+
+TEST_CASE("Half precision weights", "[storage]") {
+  using Nevolver::PackedWeight;
+
+  // every value survives a round trip, nans stay nans
+  // (checked on bits, -ffast-math breaks isnan)
+  size_t halfErrors = 0, bfloatErrors = 0;
+  for (uint32_t h = 0; h <= 0xFFFF; h++) {
+    auto half = PackedWeight::toHalf(PackedWeight::fromHalf(uint16_t(h)));
+    if ((h & 0x7FFF) > 0x7C00 ? (half & 0x7FFF) <= 0x7C00 : half != h)
+      halfErrors++;
+    auto bfloat =
+        PackedWeight::toBFloat16(PackedWeight::fromBFloat16(uint16_t(h)));
+    if ((h & 0x7FFF) > 0x7F80 ? (bfloat & 0x7FFF) <= 0x7F80 : bfloat != h)
+      bfloatErrors++;
+  }
+  REQUIRE(halfErrors == 0);
+  REQUIRE(bfloatErrors == 0);
+
+  REQUIRE(PackedWeight::toHalf(1.0f) == 0x3C00);
+  REQUIRE(PackedWeight::toHalf(-2.0f) == 0xC000);
+  REQUIRE(PackedWeight::toHalf(65504.0f) == 0x7BFF);
+  REQUIRE(PackedWeight::toHalf(65520.0f) == 0x7C00);
+  REQUIRE(PackedWeight::toHalf(std::ldexp(1.0f, -24)) == 0x0001);
+  REQUIRE(PackedWeight::toHalf(std::ldexp(1.0f, -26)) == 0x0000);
+  // ties to even
+  REQUIRE(PackedWeight::toHalf(1.0f + std::ldexp(1.0f, -11)) == 0x3C00);
+  REQUIRE(PackedWeight::toHalf(1.0f + 3 * std::ldexp(1.0f, -11)) == 0x3C02);
+  REQUIRE(PackedWeight::toBFloat16(1.0f) == 0x3F80);
+  REQUIRE(PackedWeight::toBFloat16(1.0f + std::ldexp(1.0f, -8)) == 0x3F80);
+  REQUIRE(PackedWeight::toBFloat16(1.0f + 3 * std::ldexp(1.0f, -8)) ==
+          0x3F82);
+
+  Presets presets;
+  const auto &inputs = presets.inputs;
+  for (auto net : presets.all()) {
+    net->setWeightStorage(Nevolver::WeightStorage::Float);
+    net->clear();
+    net->freeze();
+    const auto floatBytes = net->frozenPlan().weightBytes();
+    std::vector<NeuroFloat> expected;
+    for (auto &input : inputs) {
+      for (auto &v : net->activateFast(input)) {
+        expected.push_back(v);
+      }
+    }
+
+    std::stringstream fss;
+    {
+      cereal::BinaryOutputArchive oa(fss);
+      oa(*net);
+    }
+
+    for (auto storage :
+         {Nevolver::WeightStorage::Half, Nevolver::WeightStorage::BFloat16}) {
+      net->setWeightStorage(storage);
+      net->clear();
+      // dense blocks keep 16 bits per weight
+      REQUIRE(net->frozenPlan().weightBytes() < floatBytes);
+      std::vector<NeuroFloat> results;
+      for (auto &input : inputs) {
+        for (auto &v : net->activateFast(input)) {
+          results.push_back(v);
+        }
+      }
+      REQUIRE(results.size() == expected.size());
+      const auto margin =
+          storage == Nevolver::WeightStorage::Half ? 1e-2 : 5e-2;
+      for (size_t i = 0; i < results.size(); i++) {
+        REQUIRE(mean(results[i]) == Approx(mean(expected[i])).margin(margin));
+      }
+
+      std::stringstream ss;
+      {
+        cereal::BinaryOutputArchive oa(ss);
+        oa(*net);
+      }
+      REQUIRE(ss.str().size() < fss.str().size());
+
+      // loaded weights are already rounded, so both paths agree and
+      // results match the network that was saved
+      Nevolver::Network loaded;
+      cereal::BinaryInputArchive ia(ss);
+      ia(loaded);
+      REQUIRE(loaded.weightStorage() == storage);
+      checkFrozen(loaded, inputs);
+
+      loaded.clear();
+      size_t i = 0;
+      for (auto &input : inputs) {
+        for (auto &v : loaded.activateFast(input)) {
+          REQUIRE(sameBits(v, results[i++]));
+        }
+      }
+    }
+  }
+}
+
+TEST_CASE("Network copy", "[copy]") {
+  const std::vector<std::vector<NeuroFloat>> inputs{
+      {1.0, 0.0}, {0.0, 0.0}, {0.0, 1.0}, {1.0, 1.0}};
+  const std::vector<Nevolver::NetworkMutations> muts{
+      Nevolver::NetworkMutations::AddNode,
+      Nevolver::NetworkMutations::SubNode,
+      Nevolver::NetworkMutations::AddFwdConnection,
+      Nevolver::NetworkMutations::AddBwdConnection,
+      Nevolver::NetworkMutations::SubConnection,
+      Nevolver::NetworkMutations::ShareWeight,
+      Nevolver::NetworkMutations::AddGate,
+      Nevolver::NetworkMutations::SubGate};
+
+  auto lstm = Nevolver::LSTM(2, {4, 2}, 1);
+  lstm.mutate(muts, 0.5, {}, 0.0, 0.0);
+  lstm.activate(inputs[0]);
+  lstm.propagate({1.0});
+
+  // state comes along
+  Nevolver::Network copy = lstm;
+  for (auto &input : inputs) {
+    auto expected = lstm.activate(input)[0];
+    REQUIRE(sameBits(copy.activate(input)[0], expected));
+  }
+
+  // and the two are independent afterwards
+  auto stats = lstm.getStats();
+  copy.mutate(muts, 1.0, {}, 0.0, 1.0);
+  copy.propagate({0.0});
+  REQUIRE(lstm.getStats().activeConnections == stats.activeConnections);
+  REQUIRE(lstm.getStats().activeNodes == stats.activeNodes);
+  copy = lstm;
+  for (auto &input : inputs) {
+    auto expected = lstm.activate(input)[0];
+    REQUIRE(sameBits(copy.activate(input)[0], expected));
+  }
+
+  // frozen too, the plan state is handed over
+  lstm.freeze();
+  lstm.activateFast(inputs[1]);
+  Nevolver::Network frozen = lstm;
+  REQUIRE(frozen.frozen());
+  for (auto &input : inputs) {
+    auto expected = lstm.activateFast(input)[0];
+    REQUIRE(sameBits(frozen.activateFast(input)[0], expected));
+  }
+
+  // clones with and without traces
+  lstm.unfreeze();
+  lstm.activate(inputs[2]);
+  lstm.propagate({1.0}, 0.1, 0.5);
+  auto traced = lstm.clone();
+  auto untraced = lstm.clone(false);
+  Nevolver::Network cleared = lstm;
+  cleared.clear();
+  for (auto &input : inputs) {
+    auto expected = lstm.activate(input)[0];
+    REQUIRE(sameBits(traced.activate(input)[0], expected));
+    auto error = lstm.propagate({0.5}, 0.1, 0.5);
+    REQUIRE(sameBits(traced.propagate({0.5}, 0.1, 0.5), error));
+
+    expected = cleared.activate(input)[0];
+    REQUIRE(sameBits(untraced.activate(input)[0], expected));
+    error = cleared.propagate({0.5}, 0.1, 0.5);
+    REQUIRE(sameBits(untraced.propagate({0.5}, 0.1, 0.5), error));
+  }
+
+  // weight pages are shared until written
+  auto parent = Nevolver::Liquid(4, 200, 2, 4000);
+  const std::vector<NeuroFloat> input{0.1, 0.2, 0.3, 0.4};
+  Nevolver::Network control = parent;
+  auto child = parent.clone();
+  const auto pages = child.getStats().sharedWeightPages;
+  REQUIRE(pages > 2);
+  REQUIRE(parent.getStats().sharedWeightPages == pages);
+
+  child.activate(input);
+  child.mutate({}, 0.0, {}, 0.0, 0.0);
+  REQUIRE(child.getStats().sharedWeightPages == pages);
+  child.mutate({Nevolver::NetworkMutations::ShareWeight}, 1.0, {}, 0.0, 0.0);
+  REQUIRE(child.getStats().sharedWeightPages >= pages - 2);
+
+  for (auto i = 0; i < 4; i++) {
+    child.activate(input);
+    child.propagate({1.0, 0.0});
+  }
+  auto expected = control.activate(input);
+  auto output = parent.activate(input);
+  REQUIRE(sameBits(output[0], expected[0]));
+  REQUIRE(sameBits(output[1], expected[1]));
+  REQUIRE(!sameBits(child.activate(input)[0], expected[0]));
+}
+
+TEST_CASE("Connection mutations", "[mutation]") {
+  const std::vector<Nevolver::NetworkMutations> muts{
+      Nevolver::NetworkMutations::AddNode,
+      Nevolver::NetworkMutations::SubNode,
+      Nevolver::NetworkMutations::AddFwdConnection,
+      Nevolver::NetworkMutations::AddBwdConnection,
+      Nevolver::NetworkMutations::SubConnection,
+      Nevolver::NetworkMutations::ShareWeight,
+      Nevolver::NetworkMutations::AddGate,
+      Nevolver::NetworkMutations::SubGate};
+
+  // every pair is connected at most once, also after slots were recycled
+  auto checkEdges = [](Nevolver::Network &net) {
+    std::set<std::pair<uint32_t, uint32_t>> edges;
+    auto &weights = net.weights();
+    std::vector<uint32_t> users(weights.size(), 0);
+    for (auto &conn : net.connections()) {
+      if (conn.active != Nevolver::NoIndex) {
+        REQUIRE(edges.emplace(conn.from, conn.to).second);
+        users[conn.weight]++;
+      }
+    }
+    REQUIRE(edges.size() == net.getStats().activeConnections);
+
+    // and weights know how many connections use them
+    for (size_t i = 0; i < users.size(); i++) {
+      REQUIRE(weights[i].second == users[i]);
+    }
+  };
+
+  for (auto i = 0; i < 10; i++) {
+    auto liquid = Nevolver::Liquid(2, 8, 1, 40);
+    for (auto j = 0; j < 50; j++) {
+      liquid.mutate(muts, 0.5, {}, 0.0, 0.0);
+      checkEdges(liquid);
+    }
+  }
+
+  // connecting a pair twice would orphan the first connection
+  struct Rewired : Nevolver::Network {
+    Rewired(const Nevolver::Network &net) : Nevolver::Network(net) {}
+    using Nevolver::Network::connect;
+  };
+  Rewired rewired(Nevolver::Liquid(2, 8, 1, 40));
+  const auto before = rewired.getStats().activeConnections;
+  for (auto &conn : std::as_const(rewired.connections())) {
+    if (conn.active != Nevolver::NoIndex) {
+      REQUIRE_THROWS_AS(rewired.connect(conn.from, conn.to),
+                        std::runtime_error);
+    }
+  }
+  REQUIRE(rewired.getStats().activeConnections == before);
+  checkEdges(rewired);
+
+  // random picks run out near completion, every free pair is still found
+  for (auto mutation : {Nevolver::NetworkMutations::AddFwdConnection,
+                        Nevolver::NetworkMutations::AddBwdConnection}) {
+    auto small = Nevolver::Liquid(2, 3, 1, 0);
+    for (auto i = 0; i < 30; i++) {
+      small.mutate({mutation}, 1.0, {}, 0.0, 0.0);
+    }
+    checkEdges(small);
+    // 6 nodes, i <= j pairs but the 3 between inputs
+    REQUIRE(small.getStats().activeConnections == 18);
+  }
+
+  // mutations must not depend on the network size
+  auto big = Nevolver::Liquid(16, 5000, 4, 100000);
+  std::vector<Nevolver::NetworkMutations> bigMuts;
+  for (auto i = 0; i < 1000; i++) {
+    bigMuts.emplace_back(Nevolver::NetworkMutations::AddNode);
+    bigMuts.emplace_back(Nevolver::NetworkMutations::SubNode);
+    bigMuts.emplace_back(Nevolver::NetworkMutations::AddFwdConnection);
+    bigMuts.emplace_back(Nevolver::NetworkMutations::AddBwdConnection);
+    bigMuts.emplace_back(Nevolver::NetworkMutations::SubConnection);
+  }
+  for (auto i = 0; i < 10; i++) {
+    big.mutate(bigMuts, 1.0, {}, 0.0, 0.0);
+  }
+  checkEdges(big);
+
+  std::vector<NeuroFloat> output;
+  big.activateFast(std::vector<NeuroFloat>(16, 0.5), output);
+  REQUIRE(output.size() == 4);
+
+  // compacting renumbers everything but computes the same
+  auto liquid = Nevolver::Liquid(2, 40, 1, 200);
+  for (auto i = 0; i < 20; i++) {
+    liquid.mutate(muts, 0.5, {}, 0.0, 0.0);
+  }
+  // online momentum follows connections and nodes
+  liquid.activate({0.5, 0.5});
+  liquid.propagate({1.0}, 0.1, 0.5);
+  liquid.clear();
+  Nevolver::Network compacted = liquid;
+  compacted.compact();
+  checkEdges(compacted);
+  auto stats = liquid.getStats();
+  auto cstats = compacted.getStats();
+  REQUIRE(cstats.unusedNodes == 0);
+  REQUIRE(cstats.unusedConnections == 0);
+  REQUIRE(cstats.unusedWeights == 0);
+  REQUIRE(cstats.activeNodes == stats.activeNodes);
+  REQUIRE(cstats.activeConnections == stats.activeConnections);
+  REQUIRE(cstats.activeWeights == stats.activeWeights);
+  REQUIRE(compacted.weights().size() == stats.activeWeights);
+  for (auto i = 0; i < 20; i++) {
+    const std::vector<NeuroFloat> input{NeuroFloat(i % 2), NeuroFloat(i % 3)};
+    auto expected = liquid.activate(input)[0];
+    REQUIRE(sameBits(compacted.activate(input)[0], expected));
+    auto error = liquid.propagate({1.0}, 0.1, 0.5);
+    REQUIRE(sameBits(compacted.propagate({1.0}, 0.1, 0.5), error));
+  }
+
+  // so do extended traces
+  auto lstm = Nevolver::LSTM(2, {4, 2}, 1);
+  lstm.mutate({Nevolver::NetworkMutations::SubNode}, 1.0, {}, 0.0, 0.0);
+  for (auto i = 0; i < 3; i++) {
+    lstm.activate({0.5, NeuroFloat(i)});
+    lstm.propagate({1.0}, 0.1, 0.5);
+  }
+  compacted = lstm;
+  compacted.compact();
+  for (auto i = 0; i < 20; i++) {
+    const std::vector<NeuroFloat> input{NeuroFloat(i % 2), NeuroFloat(i % 3)};
+    auto expected = lstm.activate(input)[0];
+    REQUIRE(sameBits(compacted.activate(input)[0], expected));
+    auto error = lstm.propagate({1.0}, 0.1, 0.5);
+    REQUIRE(sameBits(compacted.propagate({1.0}, 0.1, 0.5), error));
+  }
+
+  // indices stay put by default, even with mostly dead slots
+  auto shrinking = Nevolver::Liquid(2, 3000, 1, 6000);
+  REQUIRE(!shrinking.autoCompact());
+  const auto last = shrinking.nodes().back();
+  std::vector<Nevolver::NetworkMutations> subs(
+      2500, Nevolver::NetworkMutations::SubNode);
+  shrinking.mutate(subs, 1.0, {}, 0.0, 0.0);
+  checkEdges(shrinking);
+  stats = shrinking.getStats();
+  REQUIRE(stats.activeNodes == 503);
+  REQUIRE(stats.unusedNodes == 2500);
+  REQUIRE(shrinking.nodes().back() == last);
+  REQUIRE(std::get<Nevolver::HiddenNode>(shrinking.node(last)).isOutput());
+  REQUIRE(shrinking.needsCompact());
+
+  // opted in, mutate compacts them itself
+  shrinking.setAutoCompact(true);
+  shrinking.mutate({}, 0.0, {}, 0.0, 0.0);
+  checkEdges(shrinking);
+  stats = shrinking.getStats();
+  REQUIRE(stats.activeNodes == 503);
+  REQUIRE(stats.unusedNodes == 0);
+  REQUIRE(stats.unusedConnections == 0);
+  shrinking.activateFast(std::vector<NeuroFloat>(2, 0.5), output);
+  REQUIRE(output.size() == 1);
+}
+
+TEST_CASE("Mutation rates", "[mutation]") {
+  auto net = Nevolver::Liquid(2, 1000, 1, 20000);
+  const auto weights = net.weights().size();
+  REQUIRE(weights == 20000);
+
+  auto mutated = [&](double weightRate, double nodeRate) {
+    Nevolver::Network copy = net;
+    copy.mutate({}, 0.0, {Nevolver::NodeMutations::Bias}, nodeRate,
+                weightRate);
+    size_t weightHits = 0;
+    for (size_t i = 0; i < weights; i++) {
+      if (!sameBits(copy.weights()[i].first, net.weights()[i].first))
+        weightHits++;
+    }
+    size_t biasHits = 0;
+    for (auto n : net.nodes()) {
+      auto hidden = std::get_if<Nevolver::HiddenNode>(&net.node(n));
+      if (hidden && !sameBits(hidden->bias(),
+                              std::get<Nevolver::HiddenNode>(copy.node(n))
+                                  .bias()))
+        biasHits++;
+    }
+    return std::make_pair(weightHits, biasHits);
+  };
+
+  REQUIRE(mutated(0.0, 0.0) == std::make_pair(size_t(0), size_t(0)));
+  REQUIRE(mutated(1.0, 1.0) == std::make_pair(weights, size_t(1001)));
+
+  // hits as many as a draw per element, within 5 sigma
+  auto hits = mutated(0.05, 0.1);
+  REQUIRE(hits.first > 845);
+  REQUIRE(hits.first < 1155);
+  REQUIRE(hits.second > 52);
+  REQUIRE(hits.second < 148);
+
+  // skipping ahead below the dense sweep threshold of 0.02
+  hits = mutated(0.01, 0.0);
+  REQUIRE(hits.first > 130);
+  REQUIRE(hits.first < 270);
+  REQUIRE(hits.second == 0);
+
+  // the dense sweep from the threshold on
+  hits = mutated(0.02, 0.0);
+  REQUIRE(hits.first > 301);
+  REQUIRE(hits.first < 499);
+  REQUIRE(hits.second == 0);
+  hits = mutated(0.3, 0.0);
+  REQUIRE(hits.first > 5676);
+  REQUIRE(hits.first < 6324);
+  REQUIRE(hits.second == 0);
+
+  // and its bulk noise is adjust() noise
+  Nevolver::Network copy = net;
+  copy.mutate({}, 0.0, {}, 0.0, 1.0);
+  double sum = 0.0, sum2 = 0.0;
+  for (size_t i = 0; i < weights; i++) {
+    float before, after;
+    std::memcpy(&before, &net.weights()[i].first, sizeof(float));
+    std::memcpy(&after, &copy.weights()[i].first, sizeof(float));
+    sum += after - before;
+    sum2 += (after - before) * (after - before);
+  }
+  const auto mean = sum / weights;
+  REQUIRE(std::abs(mean) < 0.005);
+  REQUIRE(std::sqrt(sum2 / weights - mean * mean) ==
+          Approx(Nevolver::Random::AdjustDeviation).epsilon(0.05));
+}
+
+// weights then biases
+static std::vector<NeuroFloat> snapshot(Nevolver::Network &net) {
+  std::vector<NeuroFloat> values;
+  for (auto &w : std::as_const(net.weights())) {
+    values.emplace_back(w.first);
+  }
+  for (auto n : net.nodes()) {
+    auto hidden = std::get_if<Nevolver::HiddenNode>(&net.node(n));
+    if (hidden)
+      values.emplace_back(hidden->bias());
+  }
+  return values;
+}
+
+static bool same(const std::vector<NeuroFloat> &a,
+                 const std::vector<NeuroFloat> &b) {
+  for (size_t i = 0; i < a.size(); i++) {
+    if (!sameBits(a[i], b[i]))
+      return false;
+  }
+  return a.size() == b.size();
+}
+
+TEST_CASE("Mini-batch gradients", "[gradients]") {
+  const std::vector<std::vector<NeuroFloat>> inputs{
+      {0.0, 0.0}, {0.0, 1.0}, {1.0, 0.0}, {1.0, 1.0}};
+  const std::vector<NeuroFloat> targets{0.0, 1.0, 1.0, 1.0};
+
+  auto mlp = Nevolver::MLP(2, {4, 4}, 1);
+
+  // nothing moves until the batch is applied
+  const auto before = snapshot(mlp);
+  Nevolver::Network twice = mlp;
+  mlp.activate(inputs[1]);
+  mlp.propagate({targets[1]}, 0.3, 0.0, false);
+  REQUIRE(same(snapshot(mlp), before));
+
+  // and what gets applied is the mean gradient
+  twice.activate(inputs[1]);
+  twice.propagate({targets[1]}, 0.3, 0.0, false);
+  twice.propagate({targets[1]}, 0.3, 0.0, false);
+  mlp.applyGradients(0.3);
+  twice.applyGradients(0.3);
+  REQUIRE(!same(snapshot(mlp), before));
+  REQUIRE(same(snapshot(twice), snapshot(mlp)));
+
+  // mini-batches learn or
+  for (auto epoch = 0; epoch < 2000; epoch++) {
+    for (size_t i = 0; i < inputs.size(); i++) {
+      mlp.activate(inputs[i]);
+      mlp.propagate({targets[i]}, 0.3, 0.0, false);
+    }
+    mlp.applyGradients(1.0, 0.9);
+  }
+  for (size_t i = 0; i < inputs.size(); i++) {
+    auto error = mlp.activate(inputs[i])[0] - targets[i];
+    REQUIRE(mean(error * error) < 0.04);
+  }
+}
+
+TEST_CASE("Data parallel training", "[trainer]") {
+  const std::vector<std::vector<NeuroFloat>> truth{
+      {0.0, 0.0}, {0.0, 1.0}, {1.0, 0.0}, {1.0, 1.0}};
+  const std::vector<std::vector<NeuroFloat>> ors{{0.0}, {1.0}, {1.0}, {1.0}};
+  std::vector<std::vector<NeuroFloat>> inputs;
+  std::vector<std::vector<NeuroFloat>> targets;
+  for (auto i = 0; i < 64; i++) {
+    inputs.push_back(truth[i % 4]);
+    targets.push_back(ors[i % 4]);
+  }
+
+  // the same step as one network over the whole batch, up to summation order
+  auto mlp = Nevolver::MLP(2, {4, 4}, 1);
+  Nevolver::Network serial = mlp;
+  Nevolver::Trainer trainer(mlp, 4);
+  REQUIRE(trainer.workers() == 4);
+  auto error = trainer.train(inputs, targets, 0.5, 0.9);
+  NeuroFloat serialError(0);
+  for (size_t i = 0; i < inputs.size(); i++) {
+    serial.activate(inputs[i]);
+    serialError += serial.propagate(targets[i], 0.0, 0.0, false);
+  }
+  serial.applyGradients(0.5, 0.9);
+  REQUIRE(mean(error) == Approx(mean(serialError / NeuroFloat(64.0))));
+  auto close = [](Nevolver::Network &a, Nevolver::Network &b) {
+    const auto left = snapshot(a), right = snapshot(b);
+    REQUIRE(left.size() == right.size());
+    for (size_t i = 0; i < left.size(); i++) {
+      const auto diff = left[i] - right[i];
+      REQUIRE(mean(diff * diff) < 1e-10);
+    }
+  };
+  close(mlp, serial);
+
+  // gradients pending on the network are counted once, not per replica
+  auto pending = Nevolver::MLP(2, {4, 4}, 1);
+  for (size_t i = 0; i < 3; i++) {
+    pending.activate(inputs[i]);
+    pending.propagate(targets[i], 0.0, 0.0, false);
+  }
+  Nevolver::Network pendingSerial = pending;
+  Nevolver::Trainer pendingTrainer(pending, 4);
+  pendingTrainer.train(inputs, targets, 0.5, 0.9);
+  for (size_t i = 0; i < inputs.size(); i++) {
+    pendingSerial.activate(inputs[i]);
+    pendingSerial.propagate(targets[i], 0.0, 0.0, false);
+  }
+  pendingSerial.applyGradients(0.5, 0.9);
+  close(pending, pendingSerial);
+
+  // a failing sample throws on the caller and nothing is applied
+  auto broken = inputs;
+  broken[37] = {1.0};
+  const auto before = snapshot(mlp);
+  REQUIRE_THROWS_AS(trainer.train(broken, targets, 0.5, 0.9),
+                    std::runtime_error);
+  REQUIRE(same(snapshot(mlp), before));
+
+  for (auto epoch = 0; epoch < 2000; epoch++) {
+    trainer.train(inputs, targets, 1.0, 0.9);
+  }
+  for (size_t i = 0; i < 4; i++) {
+    auto miss = mlp.activate(inputs[i])[0] - targets[i][0];
+    REQUIRE(mean(miss * miss) < 0.04);
+  }
+
+  // replicas follow the network structure after reload()
+  mlp.mutate({Nevolver::NetworkMutations::AddNode}, 1.0, {}, 0.0, 0.0);
+  trainer.reload();
+  trainer.train(inputs, targets, 0.1);
+}
+
+TEST_CASE("Optimizers", "[optimizers]") {
+  const std::vector<std::vector<NeuroFloat>> inputs{
+      {0.0, 0.0}, {0.0, 1.0}, {1.0, 0.0}, {1.0, 1.0}};
+  const std::vector<NeuroFloat> targets{0.0, 1.0, 1.0, 1.0};
+
+  // bias corrected, the first step of adam is the rate whatever the gradient
+  auto mlp = Nevolver::MLP(2, {4, 4}, 1);
+  mlp.setOptimizer(Nevolver::Optimizer::Adam);
+  REQUIRE(mlp.optimizer() == Nevolver::Optimizer::Adam);
+  const auto before = snapshot(mlp);
+  mlp.activate(inputs[1]);
+  mlp.propagate({targets[1]}, 0.0, 0.0, false);
+  mlp.applyGradients(0.01, 0.9);
+  const auto after = snapshot(mlp);
+  size_t moved = 0;
+  for (size_t i = 0; i < before.size(); i++) {
+    const auto diff = after[i] - before[i];
+    const auto d2 = mean(diff * diff);
+    if (d2 != 0) {
+      REQUIRE(d2 == Approx(0.0001).epsilon(0.01));
+      moved++;
+    }
+  }
+  REQUIRE(moved > 0);
+  REQUIRE(Nevolver::Network(mlp).optimizer() == Nevolver::Optimizer::Adam);
+
+  // beta1 of 1 or more has no bias correction, nothing is applied
+  mlp.activate(inputs[2]);
+  mlp.propagate({targets[2]}, 0.0, 0.0, false);
+  for (auto momentum : {1.0, 1.5, -0.1}) {
+    REQUIRE_THROWS_AS(mlp.applyGradients(0.01, momentum), std::runtime_error);
+  }
+  const auto unchanged = snapshot(mlp);
+  for (size_t i = 0; i < after.size(); i++) {
+    REQUIRE(sameBits(unchanged[i], after[i]));
+  }
+
+  const std::vector<std::tuple<Nevolver::Optimizer, double, double>> setups{
+      {Nevolver::Optimizer::SGD, 1.0, 0.9},
+      {Nevolver::Optimizer::Nesterov, 1.0, 0.9},
+      {Nevolver::Optimizer::RMSProp, 0.01, 0.0},
+      {Nevolver::Optimizer::Adam, 0.05, 0.9}};
+  for (auto [optimizer, rate, momentum] : setups) {
+    auto net = Nevolver::MLP(2, {4, 4}, 1);
+    net.setOptimizer(optimizer);
+    for (auto epoch = 0; epoch < 2000; epoch++) {
+      for (size_t i = 0; i < inputs.size(); i++) {
+        net.activate(inputs[i]);
+        net.propagate({targets[i]}, 0.0, 0.0, false);
+      }
+      net.applyGradients(rate, momentum);
+    }
+    for (size_t i = 0; i < inputs.size(); i++) {
+      auto miss = net.activate(inputs[i])[0] - targets[i];
+      REQUIRE(mean(miss * miss) < 0.04);
+    }
+  }
+}
+
+TEST_CASE("Plain paths", "[plain]") {
+  auto mlp = Nevolver::MLP(2, {8, 4}, 2);
+  REQUIRE(mlp.plain());
+  REQUIRE(!Nevolver::NARX(2, {4, 3}, 1, 3, 3).plain());
+  REQUIRE(!Nevolver::LSTM(2, {4}, 1).plain());
+
+  // same bits as the traced paths, online and in mini-batches
+  Nevolver::Network traced = mlp;
+  traced.setPlainPaths(false);
+  REQUIRE(!traced.plain());
+  for (auto i = 0; i < 300; i++) {
+    const std::vector<NeuroFloat> input{NeuroFloat(i % 2),
+                                        NeuroFloat(i % 3 * 0.5)};
+    const std::vector<NeuroFloat> target{NeuroFloat(i % 5 * 0.25), 1.0};
+    auto output = mlp.activate(input);
+    auto expected = traced.activate(input);
+    REQUIRE(sameBits(output[0], expected[0]));
+    REQUIRE(sameBits(output[1], expected[1]));
+    const auto update = i < 150;
+    auto error = traced.propagate(target, 0.1, 0.5, update);
+    REQUIRE(sameBits(mlp.propagate(target, 0.1, 0.5, update), error));
+    if (i % 4 == 3) {
+      mlp.applyGradients(0.1, 0.5);
+      traced.applyGradients(0.1, 0.5);
+    }
+  }
+  REQUIRE(same(snapshot(mlp), snapshot(traced)));
+
+  // plain activations leave traced propagation what it needs
+  mlp.activate({1.0, 0.5});
+  traced.activate({1.0, 0.5});
+  mlp.setPlainPaths(false);
+  REQUIRE(!mlp.plain());
+  mlp.propagate({0.0, 0.0}, 0.1);
+  traced.propagate({0.0, 0.0}, 0.1);
+  REQUIRE(same(snapshot(mlp), snapshot(traced)));
+
+  mlp.setPlainPaths(true);
+  REQUIRE(mlp.plain());
+  mlp.mutate({Nevolver::NetworkMutations::AddBwdConnection}, 1.0, {}, 0.0,
+             0.0);
+  REQUIRE(!mlp.plain());
+}
@@ -0,0 +1,195 @@
+#ifndef TRAINER_H
+#define TRAINER_H
+
+#include "network.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace Nevolver {
+/*
+Data parallel mini-batch training.
+
+Every worker runs activate and propagate, with update off, over a contiguous
+shard of the batch on its own replica of the network. Replicas are clones
+sharing weight pages with the network, which is itself worker 0 and runs on
+the calling thread. Gradients are summed in a tree, worker i adds the ones
+of i + 1, i + 2, i + 4 ... as soon as each is done, then the network applies
+the mean once and replicas take the new weights and biases back.
+
+Recurrent state only carries over within a shard. After mutating the network
+call reload(), replicas are stale otherwise.
+*/
+class Trainer final {
+public:
+  // 0 workers means one per hardware thread
+  Trainer(Network &net, size_t workers = 0) : _net(net) {
+    if (workers == 0)
+      workers = std::max(1u, std::thread::hardware_concurrency());
+
+    for (size_t i = 0; i < workers; i++) {
+      _workers.emplace_back(std::make_unique<Worker>());
+    }
+    reload();
+
+    for (size_t i = 1; i < workers; i++) {
+      _workers[i]->thread = std::thread([this, i] { loop(i); });
+    }
+  }
+
+  Trainer(const Trainer &) = delete;
+  Trainer &operator=(const Trainer &) = delete;
+
+  ~Trainer() {
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _stop = true;
+    }
+    _wake.notify_all();
+    for (size_t i = 1; i < _workers.size(); i++) {
+      _workers[i]->thread.join();
+    }
+  }
+
+  size_t workers() const { return _workers.size(); }
+
+  // clones the network again into every replica, pending gradients stay
+  // with the network alone
+  void reload() {
+    for (size_t i = 1; i < _workers.size(); i++) {
+      _workers[i]->net = _net.clone();
+      _workers[i]->net.clearGradients();
+    }
+  }
+
+  // One update from the whole batch, returns the mean error of its samples.
+  NeuroFloat train(const std::vector<std::vector<NeuroFloat>> &inputs,
+                   const std::vector<std::vector<NeuroFloat>> &targets,
+                   double rate, double momentum = 0.0) {
+    if (inputs.size() != targets.size())
+      throw std::runtime_error("Trainer inputs and targets differ in size.");
+    if (inputs.empty())
+      return NeuroFloat(0);
+
+    const auto count = _workers.size();
+    for (size_t i = 0; i < count; i++) {
+      _workers[i]->begin = inputs.size() * i / count;
+      _workers[i]->end = inputs.size() * (i + 1) / count;
+    }
+
+    uint64_t generation;
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _inputs = &inputs;
+      _targets = &targets;
+      generation = ++_generation;
+    }
+    _wake.notify_all();
+
+    run(0, generation);
+
+    std::exception_ptr failure;
+    for (auto &worker : _workers) {
+      if (worker->failure && !failure)
+        failure = worker->failure;
+      worker->failure = nullptr;
+    }
+    if (failure) {
+      // a partial batch is not applied
+      _net.clearGradients();
+      for (size_t i = 1; i < count; i++) {
+        _workers[i]->net.clearGradients();
+      }
+      std::rethrow_exception(failure);
+    }
+
+    _net.applyGradients(rate, momentum);
+    for (size_t i = 1; i < count; i++) {
+      _workers[i]->net.syncParameters(_net);
+    }
+
+    return _workers[0]->error / NeuroFloat(inputs.size());
+  }
+
+private:
+  // own cache lines, workers poll each other's done flag
+  struct alignas(64) Worker {
+    Network net;
+    std::thread thread;
+    size_t begin = 0;
+    size_t end = 0;
+    NeuroFloat error{0};
+    std::exception_ptr failure;
+    std::atomic<uint64_t> done{0};
+  };
+
+  Network &network(size_t idx) { return idx == 0 ? _net : _workers[idx]->net; }
+
+  void loop(size_t idx) {
+    uint64_t seen = 0;
+    while (true) {
+      {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _wake.wait(lock, [&] { return _stop || _generation != seen; });
+        if (_stop)
+          return;
+        seen = _generation;
+      }
+      run(idx, seen);
+    }
+  }
+
+  void run(size_t idx, uint64_t generation) {
+    auto &worker = *_workers[idx];
+    auto &net = network(idx);
+    try {
+      NeuroFloat error(0);
+      for (auto i = worker.begin; i < worker.end; i++) {
+        net.activate((*_inputs)[i]);
+        error += net.propagate((*_targets)[i], 0.0, 0.0, false);
+      }
+      worker.error = error;
+    } catch (...) {
+      worker.failure = std::current_exception();
+    }
+
+    // partners are waited for even after a failure, once worker 0 is done
+    // every other one is
+    for (size_t stride = 1;
+         idx % (stride * 2) == 0 && idx + stride < _workers.size();
+         stride *= 2) {
+      auto &other = *_workers[idx + stride];
+      while (other.done.load(std::memory_order_acquire) != generation) {
+        std::this_thread::yield();
+      }
+      if (worker.failure || other.failure)
+        continue;
+
+      try {
+        net.mergeGradients(other.net);
+        worker.error += other.error;
+      } catch (...) {
+        worker.failure = std::current_exception();
+      }
+    }
+    worker.done.store(generation, std::memory_order_release);
+  }
+
+  Network &_net;
+  std::vector<std::unique_ptr<Worker>> _workers;
+
+  std::mutex _mutex;
+  std::condition_variable _wake;
+  uint64_t _generation = 0;
+  bool _stop = false;
+
+  const std::vector<std::vector<NeuroFloat>> *_inputs = nullptr;
+  const std::vector<std::vector<NeuroFloat>> *_targets = nullptr;
+};
+} // namespace Nevolver
+
+#endif /* TRAINER_H */